@@ -34,6 +34,7 @@
 #include "island.h"
 #include "walk.h"
 #include "bench.h"
+#include "sound.h"
 #include "ads.h"
 
 
@@ -45,6 +46,11 @@
 #define OP_STOP_SCENE  1
 #define OP_NOP         2
 
+// In the benchmark, each frame stands for a tick of audio, when there
+// is a sink in virtual time to mix it. A sound starts every 50 frames
+#define BENCH_FRAME_TIME     20000     // us
+#define BENCH_SOUND_FRAMES   50
+
 
 struct TAdsChunk {           // TODO should not be here
     struct TAdsScene scene;
@@ -68,7 +74,6 @@ static int    numAdsChunksLocal;
 
 static struct TTtmSlot ttmBackgroundSlot;
 static struct TTtmSlot ttmHolidaySlot;
-static struct TTtmSlot ttmCloudsSlot;
 static struct TTtmSlot ttmSlots[MAX_TTM_SLOTS];
 
 static struct TTtmThread ttmBackgroundThread;
@@ -856,7 +861,11 @@ void adsPlayBench(void)  // TODO - tempo
             for (int i=0; i < numLayers; i++)
                 benchPlay(&ttmThreads[i], i);
 
+            if (counter % BENCH_SOUND_FRAMES == 0)
+                soundPlay(1 + (counter / BENCH_SOUND_FRAMES) % 24);
+
             grUpdateDisplay(NULL, ttmThreads, NULL, NULL);
+            soundAdvance(BENCH_FRAME_TIME);
 
             counter++;
         }
@@ -907,19 +916,13 @@ void adsInitIsland(void)
 
     islandInitHoliday(&ttmHolidayThread);
 
-    // Clouds
+    // Clouds, using the BACKGRND.BMP sprites of the background thread
 
-    ttmInitSlot(&ttmCloudsSlot);
-
-    ttmCloudsThread.ttmSlot   = &ttmCloudsSlot;
+    ttmCloudsThread.ttmSlot   = &ttmBackgroundSlot;
     ttmCloudsThread.isRunning = 3;
     ttmCloudsThread.delay     = 8;
     ttmCloudsThread.timer     = 0;
-    if (ttmCloudsThread.ttmLayer) {
-        ttmCloudsThread.ttmLayer = NULL;
-        grFreeLayer(ttmCloudsThread.ttmLayer);
-    }
-    ttmCloudsThread.ttmLayer  = grNewLayer();
+    ttmCloudsThread.ttmLayer  = NULL;  // clouds are drawn by grSetCloud()
 
     islandAnimateClouds(&ttmCloudsThread);
 }
@@ -927,6 +930,9 @@ void adsInitIsland(void)
 
 void adsReleaseIsland(void)
 {
+    ttmCloudsThread.isRunning = 0;
+    grSetNumClouds(0);
+
     ttmBackgroundThread.isRunning = 0;
     ttmResetSlot(&ttmBackgroundSlot);
 
@@ -934,11 +940,6 @@ void adsReleaseIsland(void)
         ttmHolidayThread.isRunning = 0;
         grFreeLayer(ttmHolidayThread.ttmLayer);
     }
-
-    if (ttmCloudsThread.isRunning) {
-        ttmCloudsThread.isRunning = 0;
-        grFreeLayer(ttmCloudsThread.ttmLayer);
-    }
 }
 
 
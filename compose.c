@@ -0,0 +1,577 @@
+/*
+ *  This file is part of 'Johnny Reborn'
+ *
+ *  An open-source engine for the classic
+ *  'Johnny Castaway' screensaver by Sierra.
+ *
+ *  Copyright (C) 2019 Jeremie GUILLAUME
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "mytypes.h"
+#include "utils.h"
+#include "graphics.h"
+#include "compose.h"
+
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+#define COMPOSE_USE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+// Number of horizontal bands the target is split into, one per thread.
+// 0 or 1 means the serial path: layers are blitted one after the other
+// on the whole target, by the calling thread.
+
+int composeNumThreads = 0;
+
+// If set, the target is resolved tile by tile instead of layer by layer:
+// each pixel is written once, with the topmost opaque pixel of the layers
+// having some content in the tile, and tiles in which nothing changed
+// since the previous frame are not written at all.
+
+int composeTiles = 0;
+
+
+#define COMPOSE_TILE_SIZE  32
+#define COMPOSE_TILES_X    ((SCREEN_WIDTH  + COMPOSE_TILE_SIZE - 1) / COMPOSE_TILE_SIZE)
+#define COMPOSE_TILES_Y    ((SCREEN_HEIGHT + COMPOSE_TILE_SIZE - 1) / COMPOSE_TILE_SIZE)
+#define COMPOSE_NUM_TILES  (COMPOSE_TILES_X * COMPOSE_TILES_Y)
+
+
+struct TComposeLayer {
+    PlatformSurface *sfc;
+    int    width;
+    int    height;
+    int    hasColorKey;
+    uint32 colorKey;
+    uint8  occupied[COMPOSE_NUM_TILES];   // the layer has content in the tile
+    uint8  dirty[COMPOSE_NUM_TILES];      // the content changed since last frame
+};
+
+
+struct TComposeJob {
+    PlatformSurface *dst;
+    PlatformRect    origin;
+    PlatformSurface **layers;
+    int             numLayers;
+    struct TComposeLayer *infos[MAX_COMPOSE_LAYERS];
+};
+
+
+static struct TComposeLayer composeLayerInfos[MAX_COMPOSE_LAYERS];
+
+// What each tile was resolved from, at last frame
+static PlatformSurface *composeTileLayers[COMPOSE_NUM_TILES][MAX_COMPOSE_LAYERS];
+static uint8 composeTileNumLayers[COMPOSE_NUM_TILES];
+static uint8 composeTileValid[COMPOSE_NUM_TILES];
+
+// The target may be one of two buffers used in turn: a tile whose content
+// changed in the previous frame, in the other buffer, is out of date in
+// this one. Catching up on it is not a change: the other buffer has it.
+static PlatformSurface *composeTargets[2];
+static uint8 composeTileChanged[COMPOSE_NUM_TILES];
+static uint8 composeTileStale[COMPOSE_NUM_TILES];    // in composeTargets[1]
+static int composeTargetSwapped = 0;
+
+static const uint8 composeRgbMask[4] = { 0xff, 0xff, 0xff, 0x00 };
+
+
+static struct TComposeLayer *composeFindLayer(PlatformSurface *sfc)
+{
+    for (int i=0; i < MAX_COMPOSE_LAYERS; i++)
+        if (composeLayerInfos[i].sfc == sfc)
+            return &composeLayerInfos[i];
+
+    return NULL;
+}
+
+
+static void composeMarkTiles(uint8 *tiles, int x, int y, int width, int height)
+{
+    int tx0 = (x < 0 ? 0 : x) / COMPOSE_TILE_SIZE;
+    int ty0 = (y < 0 ? 0 : y) / COMPOSE_TILE_SIZE;
+    int tx1 = (x + width  - 1) / COMPOSE_TILE_SIZE;
+    int ty1 = (y + height - 1) / COMPOSE_TILE_SIZE;
+
+    if (width <= 0 || height <= 0 || x + width <= 0 || y + height <= 0)
+        return;
+
+    if (tx1 >= COMPOSE_TILES_X) tx1 = COMPOSE_TILES_X - 1;
+    if (ty1 >= COMPOSE_TILES_Y) ty1 = COMPOSE_TILES_Y - 1;
+
+    for (int ty=ty0; ty <= ty1; ty++)
+        for (int tx=tx0; tx <= tx1; tx++)
+            tiles[ty * COMPOSE_TILES_X + tx] = 1;
+}
+
+
+static void composeResolveTile(struct TComposeJob *job, int tileNo, uint32 rgbMask)
+{
+    struct TComposeLayer *contributors[MAX_COMPOSE_LAYERS];
+    PlatformSurface *contributorSfcs[MAX_COMPOSE_LAYERS];
+    int numContributors = 0;
+    int isChanged = !composeTileValid[tileNo];
+    int isStale   = (composeTargetSwapped && composeTileStale[tileNo]);
+
+    // Which layers have something to show in this tile, bottom to top ?
+    // Layers we know nothing about are assumed to cover the whole tile
+    // and to have changed.
+
+    for (int i=0; i < job->numLayers; i++) {
+
+        struct TComposeLayer *info = job->infos[i];
+
+        if (info == NULL || info->occupied[tileNo]) {
+            contributors[numContributors] = info;
+            contributorSfcs[numContributors] = job->layers[i];
+            numContributors++;
+
+            if (info == NULL || info->dirty[tileNo])
+                isChanged = 1;
+        }
+    }
+
+    if (numContributors != composeTileNumLayers[tileNo]
+        || memcmp(contributorSfcs, composeTileLayers[tileNo],
+                  numContributors * sizeof(PlatformSurface *)))
+        isChanged = 1;
+
+    // Nothing new here: last frame's pixels are still the right ones
+    if (!isChanged && !isStale)
+        return;
+
+    if (isChanged) {
+        memcpy(composeTileLayers[tileNo], contributorSfcs, numContributors * sizeof(PlatformSurface *));
+        composeTileNumLayers[tileNo] = numContributors;
+        composeTileValid[tileNo] = 1;
+        composeTileChanged[tileNo] = 1;
+    }
+
+    int dstWidth  = platformGetSurfaceWidth(job->dst)  - job->origin.x;
+    int dstHeight = platformGetSurfaceHeight(job->dst) - job->origin.y;
+    int dstPitch  = platformGetSurfacePitch(job->dst);
+    uint8 *dstPixels = platformGetSurfacePixels(job->dst);
+
+    int x0 = (tileNo % COMPOSE_TILES_X) * COMPOSE_TILE_SIZE;
+    int y0 = (tileNo / COMPOSE_TILES_X) * COMPOSE_TILE_SIZE;
+    int x1 = x0 + COMPOSE_TILE_SIZE;
+    int y1 = y0 + COMPOSE_TILE_SIZE;
+
+    if (x1 > dstWidth)  x1 = dstWidth;
+    if (y1 > dstHeight) y1 = dstHeight;
+
+    // Fetch once what the inner loop needs to know about each layer
+
+    uint8  *srcPixels[MAX_COMPOSE_LAYERS];
+    int    srcPitches[MAX_COMPOSE_LAYERS];
+    int    srcWidths[MAX_COMPOSE_LAYERS];
+    int    srcHeights[MAX_COMPOSE_LAYERS];
+    int    srcHasKeys[MAX_COMPOSE_LAYERS];
+    uint32 srcKeys[MAX_COMPOSE_LAYERS];
+
+    for (int i=0; i < numContributors; i++) {
+        srcPixels[i]  = platformGetSurfacePixels(contributorSfcs[i]);
+        srcPitches[i] = platformGetSurfacePitch(contributorSfcs[i]);
+        srcWidths[i]  = platformGetSurfaceWidth(contributorSfcs[i]);
+        srcHeights[i] = platformGetSurfaceHeight(contributorSfcs[i]);
+        srcHasKeys[i] = (contributors[i] != NULL && contributors[i]->hasColorKey);
+        srcKeys[i]    = (contributors[i] != NULL ? contributors[i]->colorKey : 0);
+    }
+
+    // RGB565: all the surfaces are, and their keys are exact pixel values
+
+    if (platformGetSurfaceBytesPerPixel(job->dst) == 2) {
+
+        for (int y=y0; y < y1; y++) {
+
+            uint16 *dst = (uint16 *) (dstPixels + (job->origin.y + y) * dstPitch) + job->origin.x;
+
+            for (int x=x0; x < x1; x++) {
+
+                for (int i=numContributors-1; i >= 0; i--) {
+
+                    if (x >= srcWidths[i] || y >= srcHeights[i])
+                        continue;
+
+                    uint16 pixel = ((uint16 *) (srcPixels[i] + y * srcPitches[i]))[x];
+
+                    if (srcHasKeys[i] && pixel == srcKeys[i])
+                        continue;
+
+                    dst[x] = pixel;
+                    break;
+                }
+            }
+        }
+
+        return;
+    }
+
+    for (int y=y0; y < y1; y++) {
+
+        uint32 *dst = (uint32 *) (dstPixels + (job->origin.y + y) * dstPitch) + job->origin.x;
+
+        for (int x=x0; x < x1; x++) {
+
+            // Topmost opaque pixel wins. If no layer has one, the
+            // target pixel is left untouched, as the serial path does.
+
+            for (int i=numContributors-1; i >= 0; i--) {
+
+                if (x >= srcWidths[i] || y >= srcHeights[i])
+                    continue;
+
+                uint32 pixel = ((uint32 *) (srcPixels[i] + y * srcPitches[i]))[x];
+
+                if (srcHasKeys[i] && (pixel & rgbMask) == srcKeys[i])
+                    continue;
+
+                dst[x] = pixel;
+                break;
+            }
+        }
+    }
+}
+
+
+static void composeBand(struct TComposeJob *job, int bandNo, int numBands)
+{
+    if (composeTiles) {
+
+        uint32 rgbMask;
+        memcpy(&rgbMask, composeRgbMask, 4);
+
+        int ty0 = COMPOSE_TILES_Y * bandNo / numBands;
+        int ty1 = COMPOSE_TILES_Y * (bandNo + 1) / numBands;
+
+        for (int tileNo = ty0 * COMPOSE_TILES_X; tileNo < ty1 * COMPOSE_TILES_X; tileNo++)
+            composeResolveTile(job, tileNo, rgbMask);
+
+        return;
+    }
+
+    int height = platformGetSurfaceHeight(job->dst) - job->origin.y;
+    int y0 = height * bandNo / numBands;
+    int y1 = height * (bandNo + 1) / numBands;
+
+    // Every layer is blitted in z-order, restricted to the rows of the
+    // band: as blits are done pixel per pixel, the result is exactly the
+    // one of the serial path
+
+    for (int i=0; i < job->numLayers; i++) {
+
+        PlatformRect srcRect = { 0, y0, platformGetSurfaceWidth(job->layers[i]), y1 - y0 };
+        PlatformRect dstRect = { job->origin.x, job->origin.y + y0, 0, 0 };
+
+        platformBlitSurface(job->layers[i], &srcRect, job->dst, &dstRect);
+    }
+}
+
+
+#ifdef COMPOSE_USE_THREADS
+
+static pthread_t       composeThreads[MAX_COMPOSE_THREADS];
+static pthread_mutex_t composeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  composeStartCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  composeDoneCond  = PTHREAD_COND_INITIALIZER;
+
+static struct TComposeJob composeJob;
+static uint32 composeGeneration = 0;
+static int    composeNumPending = 0;
+static int    composeNumWorkers = 0;
+static int    composeQuit       = 0;
+
+
+static void *composeWorker(void *arg)
+{
+    int bandNo = (int) (intptr_t) arg;
+    uint32 generation = 0;
+
+    while (1) {
+
+        pthread_mutex_lock(&composeMutex);
+
+        while (!composeQuit && composeGeneration == generation)
+            pthread_cond_wait(&composeStartCond, &composeMutex);
+
+        if (composeQuit) {
+            pthread_mutex_unlock(&composeMutex);
+            break;
+        }
+
+        generation = composeGeneration;
+        pthread_mutex_unlock(&composeMutex);
+
+        composeBand(&composeJob, bandNo, composeNumWorkers + 1);
+
+        pthread_mutex_lock(&composeMutex);
+        if (--composeNumPending == 0)
+            pthread_cond_signal(&composeDoneCond);
+        pthread_mutex_unlock(&composeMutex);
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+void composeInit(void)
+{
+#ifdef COMPOSE_USE_THREADS
+    if (composeNumThreads < 0) {
+        long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        composeNumThreads = (numCpus > 0 ? (int) numCpus : 1);
+    }
+
+    if (composeNumThreads > MAX_COMPOSE_THREADS)
+        composeNumThreads = MAX_COMPOSE_THREADS;
+
+    // The calling thread composes the first band itself
+    composeNumWorkers = 0;
+    composeQuit = 0;
+
+    for (int i=1; i < composeNumThreads; i++) {
+        if (pthread_create(&composeThreads[composeNumWorkers], NULL,
+                           composeWorker, (void *) (intptr_t) i) != 0) {
+            debugMsg("Warning: composeInit(): could only start %d threads", composeNumWorkers);
+            break;
+        }
+        composeNumWorkers++;
+    }
+
+    debugMsg("Compositing with %d thread(s)", composeNumWorkers + 1);
+#else
+    composeNumThreads = 0;
+#endif
+}
+
+
+void composeEnd(void)
+{
+#ifdef COMPOSE_USE_THREADS
+    if (composeNumWorkers) {
+
+        pthread_mutex_lock(&composeMutex);
+        composeQuit = 1;
+        pthread_cond_broadcast(&composeStartCond);
+        pthread_mutex_unlock(&composeMutex);
+
+        for (int i=0; i < composeNumWorkers; i++)
+            pthread_join(composeThreads[i], NULL);
+
+        composeNumWorkers = 0;
+    }
+#endif
+}
+
+
+static void composeBeginFrame(PlatformSurface *dst)
+{
+    composeTargetSwapped = (dst != composeTargets[0]);
+
+    if (!composeTargetSwapped)
+        return;
+
+    // A buffer we never drew in has to be drawn in full
+    if (dst != composeTargets[1])
+        composeInvalidate();
+
+    composeTargets[1] = composeTargets[0];
+    composeTargets[0] = dst;
+}
+
+
+static void composeEndFrame(void)
+{
+    for (int i=0; i < MAX_COMPOSE_LAYERS; i++)
+        if (composeLayerInfos[i].sfc != NULL)
+            memset(composeLayerInfos[i].dirty, 0, COMPOSE_NUM_TILES);
+
+    // A frame that wasn't presented leaves the same buffer to draw in:
+    // the other one misses its changes too, until it's drawn in again
+    if (composeTargetSwapped)
+        memcpy(composeTileStale, composeTileChanged, COMPOSE_NUM_TILES);
+    else
+        for (int i=0; i < COMPOSE_NUM_TILES; i++)
+            composeTileStale[i] |= composeTileChanged[i];
+
+    memset(composeTileChanged, 0, COMPOSE_NUM_TILES);
+}
+
+
+void composeLayers(PlatformSurface *dst, PlatformRect *origin,
+                   PlatformSurface **layers, int numLayers)
+{
+#ifdef COMPOSE_USE_THREADS
+    if (composeNumWorkers) {
+
+        if (composeTiles)
+            composeBeginFrame(dst);
+
+        pthread_mutex_lock(&composeMutex);
+        composeJob.dst       = dst;
+        composeJob.origin    = *origin;
+        composeJob.layers    = layers;
+        composeJob.numLayers = numLayers;
+        for (int i=0; i < numLayers && composeTiles; i++)
+            composeJob.infos[i] = composeFindLayer(layers[i]);
+        composeNumPending    = composeNumWorkers;
+        composeGeneration++;
+        pthread_cond_broadcast(&composeStartCond);
+        pthread_mutex_unlock(&composeMutex);
+
+        composeBand(&composeJob, 0, composeNumWorkers + 1);
+
+        // Barrier: wait for every band to be done before presenting
+        pthread_mutex_lock(&composeMutex);
+        while (composeNumPending)
+            pthread_cond_wait(&composeDoneCond, &composeMutex);
+        pthread_mutex_unlock(&composeMutex);
+
+        if (composeTiles)
+            composeEndFrame();
+
+        return;
+    }
+#endif
+
+    if (composeTiles) {
+
+        struct TComposeJob job;
+
+        composeBeginFrame(dst);
+
+        job.dst       = dst;
+        job.origin    = *origin;
+        job.layers    = layers;
+        job.numLayers = numLayers;
+        for (int i=0; i < numLayers; i++)
+            job.infos[i] = composeFindLayer(layers[i]);
+
+        composeBand(&job, 0, 1);
+        composeEndFrame();
+        return;
+    }
+
+    for (int i=0; i < numLayers; i++)
+        platformBlitSurface(layers[i], NULL, dst, origin);
+}
+
+
+void composeAddLayer(PlatformSurface *sfc)
+{
+    if (!composeTiles)
+        return;
+
+    struct TComposeLayer *info = composeFindLayer(NULL);
+
+    if (info == NULL) {
+        debugMsg("Warning: composeAddLayer(): too many layers, one will be redrawn at each frame");
+        return;
+    }
+
+    uint8 r, g, b;
+    uint8 key[4] = { 0, 0, 0, 0 };
+
+    info->sfc         = sfc;
+    info->width       = platformGetSurfaceWidth(sfc);
+    info->height      = platformGetSurfaceHeight(sfc);
+    info->hasColorKey = platformGetColorKey(sfc, &r, &g, &b);
+
+    if (platformGetSurfaceBytesPerPixel(sfc) == 2) {
+        info->colorKey = platformMapRGB(sfc, r, g, b);
+    }
+    else {
+        key[0] = b; key[1] = g; key[2] = r;
+        memcpy(&info->colorKey, key, 4);
+    }
+
+    memset(info->occupied, 0, COMPOSE_NUM_TILES);
+    memset(info->dirty, 0, COMPOSE_NUM_TILES);
+
+    // A color keyed layer is registered freshly cleared, while an
+    // opaque one (a background) covers all the tiles it overlaps
+    if (!info->hasColorKey) {
+        composeMarkTiles(info->occupied, 0, 0, info->width, info->height);
+        composeMarkTiles(info->dirty, 0, 0, info->width, info->height);
+    }
+}
+
+
+void composeRemoveLayer(PlatformSurface *sfc)
+{
+    struct TComposeLayer *info;
+
+    if (!composeTiles || sfc == NULL)
+        return;
+
+    info = composeFindLayer(sfc);
+
+    if (info != NULL)
+        info->sfc = NULL;
+}
+
+
+void composeDamage(PlatformSurface *sfc, int x, int y, int width, int height)
+{
+    struct TComposeLayer *info;
+
+    if (!composeTiles)
+        return;
+
+    info = composeFindLayer(sfc);
+
+    if (info != NULL) {
+        composeMarkTiles(info->dirty, x, y, width, height);
+        if (info->hasColorKey)
+            composeMarkTiles(info->occupied, x, y, width, height);
+    }
+}
+
+
+void composeClearLayer(PlatformSurface *sfc)
+{
+    struct TComposeLayer *info;
+
+    if (!composeTiles)
+        return;
+
+    info = composeFindLayer(sfc);
+
+    if (info != NULL && info->hasColorKey) {
+
+        // What was shown there has to be erased
+        for (int i=0; i < COMPOSE_NUM_TILES; i++)
+            info->dirty[i] |= info->occupied[i];
+
+        memset(info->occupied, 0, COMPOSE_NUM_TILES);
+    }
+}
+
+
+void composeInvalidate(void)
+{
+    memset(composeTileValid, 0, COMPOSE_NUM_TILES);
+}
+
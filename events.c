@@ -23,19 +23,35 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "platform.h"
 #include "mytypes.h"
+#include "utils.h"
 #include "graphics.h"
+#include "sound.h"
 #include "events.h"
 
 
-static uint32 lastTicks = 0x00ffffff;
+// Ticks are scheduled on absolute deadlines, 20ms apart, so that the time
+// spent running scripts and drawing doesn't add up as drift. A frame
+// done late is not waited for: the following ones catch up, without
+// being shown. Beyond EV_MAX_CATCH_UP behind, we start again from now.
+// In adaptive mode, a frame known to be late before it is drawn isn't
+// even composited: the scripts keep their pace, only the display drops.
+
+#define EV_TICK_LENGTH    20000     // us
+#define EV_MAX_CATCH_UP   500000    // us
+
+static uint64 tickDeadline = 0;
 static int paused   = 0;
 static int maxSpeed = 0;
 static int oneFrame = 0;
 
 int evHotKeysEnabled = 0;
+int evAdaptive = 0;
+
+struct TEvStats evStats;
 
 
 static void eventsProcessEvents()
@@ -71,6 +87,7 @@ static void eventsProcessEvents()
                             break;
 
                         case KEY_ESCAPE:
+                            soundEnd();
                             graphicsEnd();
                             exit(255);
                             break;
@@ -82,6 +99,7 @@ static void eventsProcessEvents()
                 else {
                     // Normal behaviour : no hot keys, the screen saver
                     // terminates if any key is pressed
+                    soundEnd();
                     graphicsEnd();
                     exit(255);
                 }
@@ -92,6 +110,7 @@ static void eventsProcessEvents()
                 break;
 
             case EVENT_QUIT:
+                soundEnd();
                 graphicsEnd();
                 exit(255);
                 break;
@@ -105,22 +124,100 @@ static void eventsProcessEvents()
 
 void eventsInit(void)
 {
-    lastTicks = platformGetTicks();
+    tickDeadline = platformGetMicros();
+    memset(&evStats, 0, sizeof(evStats));
+}
+
+
+void eventsEnd(void)
+{
+    debugMsg("Ticks: %u, %u late (average %u us, max %u us), %u presents skipped (%u not composited), %u hidden, drift %u ms",
+             evStats.numTicks, evStats.numLateTicks,
+             (uint32) (evStats.numLateTicks ? evStats.totalLateness / evStats.numLateTicks : 0),
+             evStats.maxLateness, evStats.numSkippedPresents, evStats.numSkippedComposes,
+             evStats.numHiddenFrames,
+             (uint32) (evStats.drift / 1000));
+}
+
+
+// Would the frame about to be drawn be done after the next one is due ?
+int eventsFrameIsLate(uint16 delay)
+{
+    uint64 period = (uint64) delay * EV_TICK_LENGTH;
+
+    if (paused || maxSpeed || !period)
+        return 0;
+
+    return platformGetMicros() >= tickDeadline + 2 * period;
 }
 
 
-void eventsWaitTick(uint16 delay)
+// Returns 0 if the frame is so late that the next one is already due,
+// in which case it is best not shown
+int eventsWaitTick(uint16 delay)
 {
-    delay *= 20;
+    uint64 period = (uint64) delay * EV_TICK_LENGTH;
+    uint64 now;
+    int resync = 0;
+
     oneFrame = 0;
 
     eventsProcessEvents();
 
-    while ((paused && !oneFrame)
-            || (!maxSpeed && (platformGetTicks() - lastTicks < delay))) {
-        platformDelay(5);
+    tickDeadline += period;
+
+    // Audio sinks in virtual time follow the ticks, not the clock
+    soundAdvance(period);
+
+    for (;;) {
+        if (paused && !oneFrame) {
+            platformWaitEvent(PLATFORM_NO_DEADLINE);
+            resync = 1;
+        }
+        else if (maxSpeed) {
+            resync = 1;
+            break;
+        }
+        else if (platformGetMicros() < tickDeadline) {
+            platformWaitEvent(tickDeadline);
+        }
+        else {
+            break;
+        }
+
         eventsProcessEvents();
     }
 
-    lastTicks = platformGetTicks();
+    now = platformGetMicros();
+    evStats.numTicks++;
+
+    // Pauses and max speed don't count as lateness
+    if (resync) {
+        tickDeadline = now;
+        return 1;
+    }
+
+    uint64 lateness = now - tickDeadline;
+
+    // Waking up right on time is within the millisecond
+    if (lateness >= 1000) {
+        evStats.numLateTicks++;
+        evStats.totalLateness += lateness;
+        if (lateness > evStats.maxLateness)
+            evStats.maxLateness = (uint32) lateness;
+    }
+
+    if (lateness > EV_MAX_CATCH_UP) {
+        evStats.drift += lateness;
+        tickDeadline = now;
+        return 1;
+    }
+
+    // A zero delay asks for the frame to be shown right away
+    if (period && lateness >= period) {
+        evStats.numSkippedPresents++;
+        return 0;
+    }
+
+    return 1;
 }
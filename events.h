@@ -21,8 +21,23 @@
  *
  */
 
+struct TEvStats {
+    uint32 numTicks;
+    uint32 numLateTicks;          // woken up 1ms or more after the deadline
+    uint64 totalLateness;         // us, over the late ticks
+    uint32 maxLateness;           // us
+    uint32 numSkippedPresents;    // frames done after the next deadline
+    uint32 numSkippedComposes;    // of which not even composited (adaptive)
+    uint32 numHiddenFrames;       // not drawn, the window being invisible
+    uint64 drift;                 // us given up on, when too far behind
+};
+
 extern int evHotKeysEnabled;
+extern int evAdaptive;
+extern struct TEvStats evStats;
 
 void eventsInit(void);
-void eventsWaitTick(uint16 delay);
+void eventsEnd(void);
+int  eventsFrameIsLate(uint16 delay);
+int  eventsWaitTick(uint16 delay);
 
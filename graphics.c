@@ -31,14 +31,61 @@
 #include "graphics.h"
 #include "resource.h"
 #include "events.h"
+#include "compose.h"
+#include "island.h"
+
+
+#define SCREEN_CACHE_SIZE   6
 
 
 static PlatformWindow *platform_window;
 
 static uint8 ttmPalette[16][4];
+static uint16 ttmPalette565[16];
+
+// Bytes per pixel of every surface: 4, or 2 (RGB565) on a 16-bit display
+static int grPixelSize = 4;
 
 static PlatformSurface *grSavedZonesLayer = NULL;
 
+// The shore waves, kept apart so that the background itself is left
+// untouched once the island is drawn
+static PlatformSurface *grWavesLayer = NULL;
+
+// Background, waves, clouds and saved zones, flattened once and only
+// partly rebuilt when one of them changes (see grUpdateStaticBase())
+static PlatformSurface *grStaticBaseSfc = NULL;
+static PlatformSurface *grStaticInputs[3] = { NULL, NULL, NULL };
+static int grStaticCloudsShown = 0;
+static int grStaticDamageX1 = 0;
+static int grStaticDamageY1 = 0;
+static int grStaticDamageX2 = SCREEN_WIDTH;
+static int grStaticDamageY2 = SCREEN_HEIGHT;
+
+// The clouds are not given a layer of their own: they are sprite
+// instances, drawn straight into the static base
+struct TGrSprite {
+    PlatformSurface *sfc;
+    sint16 x;
+    sint16 y;
+    int    flip;
+};
+
+static struct TGrSprite grClouds[MAX_CLOUDS];
+static int grNumClouds = 0;
+
+// Palette-expanded SCR screens, in their pristine state. The same few
+// ones (OCEAN0x, NIGHT, ...) are loaded over and over, and grLoadScreen()
+// then only has to copy them. The least recently used one makes room.
+struct TGrCachedScreen {
+    struct TScrResource *scrResource;
+    uint8  *pixels;
+    uint32 lastUse;
+};
+
+static struct TGrCachedScreen grScreenCache[SCREEN_CACHE_SIZE];
+static uint32 grScreenCacheClock = 0;
+
 static PlatformRect grScreenOrigin = { 0, 0, 0, 0 };   // TODO
 
 PlatformSurface *grBackgroundSfc = NULL;
@@ -46,11 +93,39 @@ PlatformSurface *grBackgroundSfc = NULL;
 int grDx = 0;
 int grDy = 0;
 int grWindowed = 0;
+int grSmoothScaling = 0;
+char *grWindowId = NULL;
+int grAllOutputs = 0;
 int grUpdateDelay = 0;
 
+static int grWindowHidden = 0;
+
+
+static void grStaticBaseDamage(int x, int y, int width, int height)
+{
+    if (x < grStaticDamageX1)          grStaticDamageX1 = x;
+    if (y < grStaticDamageY1)          grStaticDamageY1 = y;
+    if (x + width  > grStaticDamageX2) grStaticDamageX2 = x + width;
+    if (y + height > grStaticDamageY2) grStaticDamageY2 = y + height;
+}
+
+
+// To be called whenever some pixels of a surface were modified
+static void grDamage(PlatformSurface *sfc, int x, int y, int width, int height)
+{
+    composeDamage(sfc, x, y, width, height);
+
+    if (sfc != NULL && (sfc == grStaticInputs[0]
+                        || sfc == grStaticInputs[1]
+                        || sfc == grStaticInputs[2]))
+        grStaticBaseDamage(x, y, width, height);
+}
+
 
 static void grReleaseScreen(void)
 {
+    grStaticBaseDamage(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    composeRemoveLayer(grBackgroundSfc);
     free(platformGetSurfacePixels(grBackgroundSfc));
     platformFreeSurface(grBackgroundSfc);
     grBackgroundSfc = NULL;
@@ -59,40 +134,182 @@ static void grReleaseScreen(void)
 
 static void grReleaseSavedLayer(void)
 {
+    if (grSavedZonesLayer != NULL)
+        grStaticBaseDamage(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+
+    composeRemoveLayer(grSavedZonesLayer);
     platformFreeSurface(grSavedZonesLayer);
     grSavedZonesLayer = NULL;
 }
 
 
-static void grPutPixel(PlatformSurface *sfc, uint16 x, uint16 y, uint8 color)
+static void grReleaseWavesLayer(void)
 {
-    // TODO: Implement Cohen-Sutherland clipping algorithm or such for
-    // grDrawLine(), and another ad hoc algorithm for grDrawCircle()
+    grStaticBaseDamage(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    composeRemoveLayer(grWavesLayer);
+    platformFreeSurface(grWavesLayer);
+    grWavesLayer = NULL;
+}
+
+
+// Raw view of a surface, fetched once per primitive instead of
+// once per pixel
+struct TGrTarget {
+    uint8 *pixels;
+    int   pitch;
+    int   width;
+    int   height;
+    int   bytesPerPixel;
+};
+
 
-    if (x>=0 && y>=0 && x<SCREEN_WIDTH && y<SCREEN_HEIGHT) {
+static void grGetTarget(PlatformSurface *sfc, struct TGrTarget *target)
+{
+    target->pixels = platformGetSurfacePixels(sfc);
+    target->pitch  = platformGetSurfacePitch(sfc);
+    target->width  = platformGetSurfaceWidth(sfc);
+    target->height = platformGetSurfaceHeight(sfc);
+    target->bytesPerPixel = platformGetSurfaceBytesPerPixel(sfc);
+}
 
-        uint8 *pixel = platformGetSurfacePixels(sfc);
 
-        pixel += (y * platformGetSurfacePitch(sfc)) + (x * platformGetSurfaceBytesPerPixel(sfc));
+static uint32 grPaletteColor(uint8 color)
+{
+    uint32 result;
+
+    if (grPixelSize == 2)
+        return ttmPalette565[color];
+
+    memcpy(&result, ttmPalette[color], 4);
+    return result;
+}
+
+
+static void grStorePixel(struct TGrTarget *target, int x, int y, uint32 color)
+{
+    if (target->bytesPerPixel == 2)
+        ((uint16 *) (target->pixels + y * target->pitch))[x] = color;
+    else
+        ((uint32 *) (target->pixels + y * target->pitch))[x] = color;
+}
+
 
-        pixel[0] = ttmPalette[color][0];
-        pixel[1] = ttmPalette[color][1];
-        pixel[2] = ttmPalette[color][2];
-        pixel[3] = 0;
+static void grPutPixel(struct TGrTarget *target, int x, int y, uint32 color)
+{
+    if (x >= 0 && y >= 0 && x < target->width && y < target->height)
+        grStorePixel(target, x, y, color);
+}
+
+
+// From 4-bit pixels, two per byte, to surface pixels
+static void grExpandPixels(uint8 *outData, uint8 *inPtr, int numPixels)
+{
+    if (grPixelSize == 2) {
+        uint16 *outPtr = (uint16 *) outData;
+
+        for (int inOffset=0; inOffset < numPixels/2; inOffset++) {
+            *outPtr++ = ttmPalette565[(inPtr[0] & 0xf0) >> 4];
+            *outPtr++ = ttmPalette565[(inPtr[0] & 0x0f)     ];
+            inPtr++;
+        }
+        return;
+    }
+
+    uint8 *outPtr = outData;
+
+    for (int inOffset=0; inOffset < numPixels/2; inOffset++) {
+        memcpy(outPtr, ttmPalette[(inPtr[0] & 0xf0) >> 4] , 4); outPtr += 4;
+        memcpy(outPtr, ttmPalette[(inPtr[0] & 0x0f)     ] , 4); outPtr += 4;
+        inPtr++;
     }
 }
 
 
-static void grDrawHorizontalLine(PlatformSurface *sfc, sint16 x1, sint16 x2, sint16 y, uint8 color)
+static void grDrawHorizontalLine(struct TGrTarget *target, int x1, int x2, int y, uint32 color)
 {
-    if (y < 0 || y > 479)
+    if (y < 0 || y >= target->height)
+        return;
+
+    x1 = x1 < 0 ? 0 : x1;
+    x2 = x2 >= target->width ? target->width - 1 : x2;
+
+    if (target->bytesPerPixel == 2) {
+        uint16 *pixel = ((uint16 *) (target->pixels + y * target->pitch)) + x1;
+
+        for (int x=x1; x<=x2; x++)
+            *pixel++ = color;
         return;
+    }
 
-    x1 = x1 < 0   ? 0   : x1;
-    x2 = x2 > 639 ? 639 : x2;
+    uint32 *pixel = ((uint32 *) (target->pixels + y * target->pitch)) + x1;
 
     for (int x=x1; x<=x2; x++)
-        grPutPixel(sfc, x, y, color);
+        *pixel++ = color;
+}
+
+
+// Cohen-Sutherland outcode of a point relatively to the target
+static int grOutCode(struct TGrTarget *target, int x, int y)
+{
+    int code = 0;
+
+    if (x < 0)                   code |= 1;
+    else if (x >= target->width) code |= 2;
+
+    if (y < 0)                    code |= 4;
+    else if (y >= target->height) code |= 8;
+
+    return code;
+}
+
+
+static void grFlushScreenCache(void)
+{
+    for (int i=0; i < SCREEN_CACHE_SIZE; i++) {
+        free(grScreenCache[i].pixels);
+        grScreenCache[i].scrResource = NULL;
+        grScreenCache[i].pixels = NULL;
+        grScreenCache[i].lastUse = 0;
+    }
+}
+
+
+static uint8 *grGetCachedScreen(struct TScrResource *scrResource)
+{
+    struct TGrCachedScreen *entry = &grScreenCache[0];
+
+    grScreenCacheClock++;
+
+    // Else, the entry to reuse: a free one, stamped 0, or else the one
+    // with the oldest stamp
+    for (int i=0; i < SCREEN_CACHE_SIZE; i++) {
+        if (grScreenCache[i].scrResource == scrResource) {
+            grScreenCache[i].lastUse = grScreenCacheClock;
+            return grScreenCache[i].pixels;
+        }
+
+        if (grScreenCache[i].lastUse < entry->lastUse)
+            entry = &grScreenCache[i];
+    }
+
+    uint16 width  = scrResource->width;
+    uint16 height = scrResource->height;
+
+    uint8 *outData = entry->pixels;
+
+    if (entry->scrResource == NULL
+        || entry->scrResource->width * entry->scrResource->height != width * height) {
+        free(outData);
+        outData = safe_malloc(width * height * grPixelSize);
+    }
+
+    grExpandPixels(outData, scrResource->uncompressedData, width * height);
+
+    entry->scrResource = scrResource;
+    entry->pixels      = outData;
+    entry->lastUse     = grScreenCacheClock;
+
+    return outData;
 }
 
 
@@ -101,11 +318,18 @@ void grLoadPalette(struct TPalResource *palResource)
     if (palResource == NULL)
         fatalError("NULL palette\n");
 
+    grFlushScreenCache();
+    islandReleaseStacks();
+
     for (int i=0; i < 16; i++) {
         ttmPalette[i][0] = palResource->colors[i].b << 2;
         ttmPalette[i][1] = palResource->colors[i].g << 2;
         ttmPalette[i][2] = palResource->colors[i].r << 2;
         ttmPalette[i][3] = 0;
+
+        ttmPalette565[i] = ((ttmPalette[i][2] & 0xf8) << 8)
+                         | ((ttmPalette[i][1] & 0xfc) << 3)
+                         |  (ttmPalette[i][0] >> 3);
     }
 }
 
@@ -113,17 +337,24 @@ void grLoadPalette(struct TPalResource *palResource)
 void graphicsInit(void)
 {
     platformInit();
-
-    platform_window = platformCreateWindow(
-        "Johnny Reborn ...?",
-        SCREEN_WIDTH,
-        SCREEN_HEIGHT,
-        (grWindowed ? 0 : 1)
-    );
+    platformSetScaleFilter(grSmoothScaling);
+    platformSetAllOutputs(grAllOutputs);
+
+    if (grWindowId != NULL)
+        platform_window = platformAdoptWindow(grWindowId, SCREEN_WIDTH, SCREEN_HEIGHT);
+    else
+        platform_window = platformCreateWindow(
+            "Johnny Reborn ...?",
+            SCREEN_WIDTH,
+            SCREEN_HEIGHT,
+            (grWindowed ? 0 : 1)
+        );
 
     if (platform_window == NULL)
         fatalError("Could not create window: %s", platformGetError());
 
+    grPixelSize = platformGetPixelSize();
+
     grScreenOrigin.x = (SCREEN_WIDTH - 640) / 2;
     grScreenOrigin.y = (SCREEN_HEIGHT - 480) / 2;
 
@@ -136,12 +367,24 @@ void graphicsInit(void)
 
     srand(time(NULL));
 
+    composeInit();
     eventsInit();
 }
 
 
 void graphicsEnd(void)
 {
+    eventsEnd();
+    composeEnd();
+
+    if (grStaticBaseSfc != NULL) {
+        grFreeLayer(grStaticBaseSfc);
+        grStaticBaseSfc = NULL;
+    }
+
+    grFlushScreenCache();
+    islandReleaseStacks();
+
     platformDestroyWindow(platform_window);
     platformShutdown();
 }
@@ -149,7 +392,7 @@ void graphicsEnd(void)
 
 void grRefreshDisplay(void)
 {
-    platformUpdateWindow(platform_window);
+    platformRefreshWindow(platform_window);
 }
 
 
@@ -166,7 +409,129 @@ void grToggleFullScreen(void)
         platformShowCursor(0);
     }
 
-    platformUpdateWindow(platform_window);
+    platformRefreshWindow(platform_window);
+}
+
+
+static void grBlitSpriteFlip(PlatformSurface *srcSfc, PlatformSurface *sfc, sint16 x, sint16 y)
+{
+    x += platformGetSurfaceWidth(srcSfc) - 1;
+
+    for (int i=0; i < platformGetSurfaceWidth(srcSfc); i++) {
+
+        PlatformRect src = { i, 0, 1, platformGetSurfaceHeight(srcSfc) };
+        PlatformRect dest = { x - i, y, 0, 0 };
+
+        platformBlitSurface(srcSfc, &src, sfc, &dest);
+    }
+}
+
+
+static void grDamageCloud(int cloudNo)
+{
+    struct TGrSprite *cloud = &grClouds[cloudNo];
+
+    grStaticBaseDamage(cloud->x, cloud->y,
+                       platformGetSurfaceWidth(cloud->sfc),
+                       platformGetSurfaceHeight(cloud->sfc));
+}
+
+
+// The background, waves, clouds and saved zones are the bottom of the
+// stack and seldom change (the clouds and waves every 8 ticks, the rest on
+// LOAD_SCREEN, COPY_ZONE_TO_BG and RESTORE_ZONE), so we keep them
+// flattened in one opaque surface. Only the damaged part of it is
+// rebuilt, and each frame then starts with a plain copy of it.
+// The holiday layer can't join them, as it is drawn above the threads.
+//
+// Returns 0 if the background doesn't cover the screen, in which case
+// the layers have to be composited separately. There are no clouds
+// then, as they only exist above the ocean.
+
+static int grUpdateStaticBase(int showClouds)
+{
+    PlatformSurface *inputs[3] = { grBackgroundSfc, grWavesLayer, grSavedZonesLayer };
+
+    if (grBackgroundSfc == NULL
+        || platformGetSurfaceWidth(grBackgroundSfc)  < SCREEN_WIDTH
+        || platformGetSurfaceHeight(grBackgroundSfc) < SCREEN_HEIGHT) {
+        grStaticBaseDamage(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        return 0;
+    }
+
+    if (grStaticBaseSfc == NULL) {
+        grStaticBaseSfc = platformCreateSurface(SCREEN_WIDTH, SCREEN_HEIGHT);
+        composeAddLayer(grStaticBaseSfc);
+        grStaticBaseDamage(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+
+    // A layer appeared or disappeared
+    if (memcmp(inputs, grStaticInputs, sizeof(inputs))) {
+        memcpy(grStaticInputs, inputs, sizeof(inputs));
+        grStaticBaseDamage(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+
+    if (showClouds != grStaticCloudsShown) {
+        grStaticCloudsShown = showClouds;
+        for (int i=0; i < grNumClouds; i++)
+            grDamageCloud(i);
+    }
+
+    if (grStaticDamageX1 < 0)             grStaticDamageX1 = 0;
+    if (grStaticDamageY1 < 0)             grStaticDamageY1 = 0;
+    if (grStaticDamageX2 > SCREEN_WIDTH)  grStaticDamageX2 = SCREEN_WIDTH;
+    if (grStaticDamageY2 > SCREEN_HEIGHT) grStaticDamageY2 = SCREEN_HEIGHT;
+
+    if (grStaticDamageX1 < grStaticDamageX2 && grStaticDamageY1 < grStaticDamageY2) {
+
+        PlatformRect rect = {
+            grStaticDamageX1,
+            grStaticDamageY1,
+            grStaticDamageX2 - grStaticDamageX1,
+            grStaticDamageY2 - grStaticDamageY1
+        };
+
+        PlatformRect dest = rect;
+        platformBlitSurface(grBackgroundSfc, &rect, grStaticBaseSfc, &dest);
+
+        if (grWavesLayer != NULL) {
+            dest = rect;
+            platformBlitSurface(grWavesLayer, &rect, grStaticBaseSfc, &dest);
+        }
+
+        if (showClouds && grNumClouds) {
+            PlatformRect fullRect = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+
+            platformSetClipRect(grStaticBaseSfc, &rect);
+
+            for (int i=0; i < grNumClouds; i++) {
+                struct TGrSprite *cloud = &grClouds[i];
+
+                if (cloud->flip) {
+                    grBlitSpriteFlip(cloud->sfc, grStaticBaseSfc, cloud->x, cloud->y);
+                }
+                else {
+                    dest.x = cloud->x;
+                    dest.y = cloud->y;
+                    platformBlitSurface(cloud->sfc, NULL, grStaticBaseSfc, &dest);
+                }
+            }
+
+            platformSetClipRect(grStaticBaseSfc, &fullRect);
+        }
+
+        if (grSavedZonesLayer != NULL) {
+            dest = rect;
+            platformBlitSurface(grSavedZonesLayer, &rect, grStaticBaseSfc, &dest);
+        }
+
+        composeDamage(grStaticBaseSfc, rect.x, rect.y, rect.w, rect.h);
+    }
+
+    grStaticDamageX1 = grStaticDamageY1 = 0x7fff;
+    grStaticDamageX2 = grStaticDamageY2 = 0;
+
+    return 1;
 }
 
 
@@ -176,51 +541,68 @@ void grUpdateDisplay(struct TTtmThread *ttmBackgroundThread,
                      struct TTtmThread *ttmCloudsThread)
 {
     PlatformSurface* windowSurface = platformGetWindowSurface(platform_window);
-    
-    // Blit the background
-    if (grBackgroundSfc != NULL)
-        platformBlitSurface(grBackgroundSfc,
-                        NULL,
-                        windowSurface,
-                        &grScreenOrigin);
-
-    // Blit the Clouds
-    if (ttmCloudsThread != NULL)
-        if (ttmCloudsThread->isRunning)
-            platformBlitSurface(ttmCloudsThread->ttmLayer,
-                            NULL,
-                            windowSurface,
-                            &grScreenOrigin);
-
-    // If not NULL, blit the optional layer of saved zones
-    if (grSavedZonesLayer != NULL)
-        platformBlitSurface(grSavedZonesLayer,
-                        NULL,
-                        windowSurface,
-                        &grScreenOrigin);
+    PlatformSurface* layers[MAX_TTM_THREADS + 4];
+    int numLayers = 0;
+
+    // Nobody can see the window: the story goes on, but isn't drawn.
+    // Once it's visible again, the first frame is drawn in full
+    if (!platformIsWindowVisible(platform_window)) {
+        grWindowHidden = 1;
+        evStats.numHiddenFrames++;
+        eventsWaitTick(grUpdateDelay);
+        return;
+    }
+
+    if (grWindowHidden) {
+        grWindowHidden = 0;
+        composeInvalidate();
+    }
+
+    // In adaptive mode, don't draw a frame that would be dropped anyway.
+    // What changed meanwhile stays marked, and goes in the next one
+    if (evAdaptive && eventsFrameIsLate(grUpdateDelay)) {
+        evStats.numSkippedComposes++;
+        eventsWaitTick(grUpdateDelay);
+        return;
+    }
 
+    int showClouds = (ttmCloudsThread != NULL && ttmCloudsThread->isRunning);
 
-    // Blit successively each thread's layer
+    // Background, clouds and saved zones, flattened if possible
+    if (grUpdateStaticBase(showClouds)) {
+        layers[numLayers++] = grStaticBaseSfc;
+    }
+    else {
+        // The background
+        if (grBackgroundSfc != NULL)
+            layers[numLayers++] = grBackgroundSfc;
+
+        // The shore waves
+        if (grWavesLayer != NULL)
+            layers[numLayers++] = grWavesLayer;
+
+        // If not NULL, the optional layer of saved zones
+        if (grSavedZonesLayer != NULL)
+            layers[numLayers++] = grSavedZonesLayer;
+    }
+
+    // Successively each thread's layer
     for (int i=0; i < MAX_TTM_THREADS; i++)
         if (ttmThreads[i].isRunning)
-            platformBlitSurface(ttmThreads[i].ttmLayer,
-                            NULL,
-                            windowSurface,
-                            &grScreenOrigin);
+            layers[numLayers++] = ttmThreads[i].ttmLayer;
 
-    // Finally, blit the holiday layer
+    // Finally, the holiday layer
     if (ttmHolidayThread != NULL)
         if (ttmHolidayThread->isRunning)
-            platformBlitSurface(ttmHolidayThread->ttmLayer,
-                            NULL,
-                            windowSurface,
-                            &grScreenOrigin);
+            layers[numLayers++] = ttmHolidayThread->ttmLayer;
 
-    // Wait for the tick ...
-    eventsWaitTick(grUpdateDelay);
+    // Blit them in that order
+    composeLayers(windowSurface, &grScreenOrigin, layers, numLayers);
 
-    // ... and refresh the display
-    platformUpdateWindow(platform_window);
+    // Wait for the tick, and hand the frame over to the display, unless
+    // we're so late that the next one is already due
+    if (eventsWaitTick(grUpdateDelay))
+        platformPresentWindow(platform_window);
 }
 PlatformSurface *grNewLayer(void)
 {
@@ -228,13 +610,28 @@ PlatformSurface *grNewLayer(void)
     PlatformRect dest = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
     platformFillRect(sfc, &dest, 0xa8, 0, 0xa8, 0);
     platformSetColorKey(sfc, 0xa8, 0, 0xa8);
+    composeAddLayer(sfc);
 
     return sfc;
 }
 
 
+// The layer the shore waves are drawn on, created on first use and
+// dropped along with the background it belongs to
+
+PlatformSurface *grGetWavesLayer(void)
+{
+    if (grWavesLayer == NULL)
+        grWavesLayer = grNewLayer();
+
+    return grWavesLayer;
+}
+
+
 void grFreeLayer(PlatformSurface *sfc)
 {
+    grDamage(sfc, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    composeRemoveLayer(sfc);
     platformFreeSurface(sfc);
 }
 
@@ -258,6 +655,7 @@ void grCopyZoneToBg(PlatformSurface *sfc, uint16 x, uint16 y, uint16 width, uint
         grSavedZonesLayer = grNewLayer();
 
     platformBlitSurface(sfc, &rect, grSavedZonesLayer, &rect);
+    grDamage(grSavedZonesLayer, rect.x, rect.y, rect.w, rect.h);
 
     // Note : without the +2 in width+2 above, there would be a graphical
     // glitch (2 unfilled pixels) on the hull of the cargo, caused by an
@@ -295,7 +693,11 @@ void grRestoreZone(PlatformSurface *sfc, uint16 x, uint16 y, uint16 width, uint1
 void grDrawPixel(PlatformSurface *sfc, sint16 x, sint16 y, uint8 color)
 {
     x += grDx; y += grDy;
-    grPutPixel(sfc, x, y, color);
+
+    struct TGrTarget target;
+    grGetTarget(sfc, &target);
+    grPutPixel(&target, x, y, grPaletteColor(color));
+    grDamage(sfc, x, y, 1, 1);
 }
 
 
@@ -304,12 +706,33 @@ void grDrawLine(PlatformSurface *sfc, sint16 x1, sint16 y1, sint16 x2, sint16 y2
     x1 += grDx; y1 += grDy;
     x2 += grDx; y2 += grDy;
 
+    struct TGrTarget target;
+    grGetTarget(sfc, &target);
+
+    // Clip up front: a line whose both ends lie on the same outer side
+    // of the surface draws nothing, and a line whose both ends are inside
+    // needs no per-pixel bounds check. Partially visible lines are not
+    // shortened, as moving the end points would shift the Bresenham
+    // error term and break pixel-perfection.
+
+    int outCode1 = grOutCode(&target, x1, y1);
+    int outCode2 = grOutCode(&target, x2, y2);
+
+    if (outCode1 & outCode2)
+        return;
+
+    grDamage(sfc, (x1 < x2 ? x1 : x2), (y1 < y2 ? y1 : y2),
+             abs(x2 - x1) + 1, abs(y2 - y1) + 1);
+
+    int isInside = !(outCode1 | outCode2);
+    uint32 color32 = grPaletteColor(color);
+
     platformLockSurface(sfc);
 
     // Bresenham's line drawing algorithm
     // Note : the code below intends to be pixel-perfect
 
-    uint16 dx, dy, cumul, x, y;
+    int dx, dy, cumul, x, y;
     int xinc, yinc;
 
     x = x1;
@@ -325,7 +748,10 @@ void grDrawLine(PlatformSurface *sfc, sint16 x1, sint16 y1, sint16 x2, sint16 y2
 
         for (int i=0; i < dx; i++) {
 
-            grPutPixel(sfc, x, y, color);
+            if (isInside)
+                grStorePixel(&target, x, y, color32);
+            else
+                grPutPixel(&target, x, y, color32);
 
             x += xinc;
             cumul += dy;
@@ -341,7 +767,10 @@ void grDrawLine(PlatformSurface *sfc, sint16 x1, sint16 y1, sint16 x2, sint16 y2
 
         for (int i=0; i < dy; i++) {
 
-            grPutPixel(sfc, x, y, color);
+            if (isInside)
+                grStorePixel(&target, x, y, color32);
+            else
+                grPutPixel(&target, x, y, color32);
 
             y += yinc;
             cumul += dx;
@@ -362,6 +791,7 @@ void grDrawRect(PlatformSurface *sfc, sint16 x, sint16 y, uint16 width, uint16 h
     x += grDx; y += grDy;
 
     PlatformRect dest = { x, y, width, height };
+    grDamage(sfc, x, y, width, height);
     platformFillRect(sfc, &dest,
                      ttmPalette[color][2],  // TODO ?
                      ttmPalette[color][1],
@@ -390,22 +820,30 @@ void grDrawCircle(PlatformSurface *sfc, sint16 x1, sint16 y1, uint16 width, uint
     // Bresenham's circle drawing algorithm
     // Note : the code below intends to be pixel-perfect
 
+    struct TGrTarget target;
+    grGetTarget(sfc, &target);
+
+    grDamage(sfc, x1, y1, width, height);
+
+    uint32 fgColor32 = grPaletteColor(fgColor);
+    uint32 bgColor32 = grPaletteColor(bgColor);
+
     platformLockSurface(sfc);
 
-    uint16 r = (width >> 1) - 1;
-    uint16 xc = x1 + r;
-    uint16 yc = y1 + r;
-    sint16 x = 0;
-    sint16 y = r;
+    int r = (width >> 1) - 1;
+    int xc = x1 + r;
+    int yc = y1 + r;
+    int x = 0;
+    int y = r;
     int d = 1 - r;
 
     while (1) {
 
-        grDrawHorizontalLine(sfc, xc-x, xc+x+1, yc+y+1, bgColor);
-        grDrawHorizontalLine(sfc, xc-x, xc+x+1, yc-y  , bgColor);
+        grDrawHorizontalLine(&target, xc-x, xc+x+1, yc+y+1, bgColor32);
+        grDrawHorizontalLine(&target, xc-x, xc+x+1, yc-y  , bgColor32);
 
-        grDrawHorizontalLine(sfc, xc-y, xc+y+1, yc+x+1, bgColor);
-        grDrawHorizontalLine(sfc, xc-y, xc+y+1, yc-x  , bgColor);
+        grDrawHorizontalLine(&target, xc-y, xc+y+1, yc+x+1, bgColor32);
+        grDrawHorizontalLine(&target, xc-y, xc+y+1, yc-x  , bgColor32);
 
         if (y-x <= 1)
             break;
@@ -428,17 +866,17 @@ void grDrawCircle(PlatformSurface *sfc, sint16 x1, sint16 y1, uint16 width, uint
 
         while (1) {
 
-            grPutPixel(sfc, xc-x  , yc+y+1, fgColor);
-            grPutPixel(sfc, xc+x+1, yc+y+1, fgColor);
+            grPutPixel(&target, xc-x  , yc+y+1, fgColor32);
+            grPutPixel(&target, xc+x+1, yc+y+1, fgColor32);
 
-            grPutPixel(sfc, xc-x  , yc-y  , fgColor);
-            grPutPixel(sfc, xc+x+1, yc-y  , fgColor);
+            grPutPixel(&target, xc-x  , yc-y  , fgColor32);
+            grPutPixel(&target, xc+x+1, yc-y  , fgColor32);
 
-            grPutPixel(sfc, xc-y  , yc+x+1, fgColor);
-            grPutPixel(sfc, xc+y+1, yc+x+1, fgColor);
+            grPutPixel(&target, xc-y  , yc+x+1, fgColor32);
+            grPutPixel(&target, xc+y+1, yc+x+1, fgColor32);
 
-            grPutPixel(sfc, xc-y  , yc-x  , fgColor);
-            grPutPixel(sfc, xc+y+1, yc-x  , fgColor);
+            grPutPixel(&target, xc-y  , yc-x  , fgColor32);
+            grPutPixel(&target, xc+y+1, yc-x  , fgColor32);
 
             if (y-x <= 1)
                 break;
@@ -465,12 +903,62 @@ void grDrawSprite(PlatformSurface *sfc, struct TTtmSlot *ttmSlot, sint16 x, sint
         return;
     }
 
-    x += grDx; y += grDy;
+    grDrawSurface(sfc, ttmSlot->sprites[imageNo][spriteNo], x, y);
+}
 
-    PlatformSurface *srcSfc = ttmSlot->sprites[imageNo][spriteNo];
+
+// Same as grDrawSprite(), for a surface not held by a TTM slot, such as
+// one made by grFlattenSprites()
+
+void grDrawSurface(PlatformSurface *sfc, PlatformSurface *srcSfc, sint16 x, sint16 y)
+{
+    x += grDx; y += grDy;
 
     PlatformRect dest = { x, y, 0, 0 };
     platformBlitSurface(srcSfc, NULL, sfc, &dest);
+    grDamage(sfc, x, y, platformGetSurfaceWidth(srcSfc), platformGetSurfaceHeight(srcSfc));
+}
+
+
+// Draw a list of sprites, in that order, onto a new color-keyed surface
+// just big enough to hold them. Its position is returned in (*x,*y), so
+// that drawing it there gives the same picture as drawing each sprite.
+
+PlatformSurface *grFlattenSprites(struct TTtmSlot *ttmSlot, struct TGrSpriteRef *sprites, int numSprites, sint16 *x, sint16 *y)
+{
+    int x1 = 0x7fff, y1 = 0x7fff, x2 = -0x8000, y2 = -0x8000;
+
+    for (int i=0; i < numSprites; i++) {
+
+        if (sprites[i].spriteNo >= ttmSlot->numSprites[sprites[i].imageNo])
+            fatalError("grFlattenSprites(): less than %d sprites loaded in slot %d",
+                       sprites[i].spriteNo + 1, sprites[i].imageNo);
+
+        PlatformSurface *srcSfc = ttmSlot->sprites[sprites[i].imageNo][sprites[i].spriteNo];
+
+        if (sprites[i].x < x1) x1 = sprites[i].x;
+        if (sprites[i].y < y1) y1 = sprites[i].y;
+        if (sprites[i].x + platformGetSurfaceWidth(srcSfc)  > x2) x2 = sprites[i].x + platformGetSurfaceWidth(srcSfc);
+        if (sprites[i].y + platformGetSurfaceHeight(srcSfc) > y2) y2 = sprites[i].y + platformGetSurfaceHeight(srcSfc);
+    }
+
+    if (x1 >= x2 || y1 >= y2)
+        fatalError("grFlattenSprites(): nothing to draw");
+
+    PlatformSurface *sfc = platformCreateSurface(x2 - x1, y2 - y1);
+    platformFillRect(sfc, NULL, 0xa8, 0, 0xa8, 0);
+    platformSetColorKey(sfc, 0xa8, 0, 0xa8);
+
+    for (int i=0; i < numSprites; i++) {
+        PlatformRect dest = { sprites[i].x - x1, sprites[i].y - y1, 0, 0 };
+        platformBlitSurface(ttmSlot->sprites[sprites[i].imageNo][sprites[i].spriteNo],
+                            NULL, sfc, &dest);
+    }
+
+    *x = x1;
+    *y = y1;
+
+    return sfc;
 }
 
 
@@ -484,15 +972,54 @@ void grDrawSpriteFlip(PlatformSurface *sfc, struct TTtmSlot *ttmSlot, sint16 x,
     x += grDx; y += grDy;
 
     PlatformSurface *srcSfc = ttmSlot->sprites[imageNo][spriteNo];
-    x += platformGetSurfaceWidth(srcSfc) - 1;
+    grDamage(sfc, x, y, platformGetSurfaceWidth(srcSfc), platformGetSurfaceHeight(srcSfc));
+    grBlitSpriteFlip(srcSfc, sfc, x, y);
+}
 
-    for (int i=0; i < platformGetSurfaceWidth(srcSfc); i++) {
 
-        PlatformRect src = { i, 0, 1, platformGetSurfaceHeight(srcSfc) };
-        PlatformRect dest = { x - i, y, 0, 0 };
+// Place cloud #cloudNo (numbered from 0, without gaps), which is sprite
+// spriteNo of BMP slot imageNo, at (x,y). Only the areas it leaves and
+// enters are redrawn.
 
-        platformBlitSurface(srcSfc, &src, sfc, &dest);
+void grSetCloud(int cloudNo, struct TTtmSlot *ttmSlot, sint16 x, sint16 y, uint16 spriteNo, uint16 imageNo, int flip)
+{
+    if (spriteNo >= ttmSlot->numSprites[imageNo]) {
+        fprintf(stderr, "Warning : grSetCloud(): less than %d sprites loaded in slot %d\n", spriteNo + 1, imageNo);
+        return;
+    }
+
+    struct TGrSprite *cloud = &grClouds[cloudNo];
+    PlatformSurface *srcSfc = ttmSlot->sprites[imageNo][spriteNo];
+
+    x += grDx; y += grDy;
+
+    if (cloudNo < grNumClouds) {
+        if (cloud->sfc == srcSfc && cloud->x == x && cloud->y == y && cloud->flip == flip)
+            return;
+        grDamageCloud(cloudNo);
+    }
+    else {
+        grNumClouds = cloudNo + 1;
     }
+
+    cloud->sfc  = srcSfc;
+    cloud->x    = x;
+    cloud->y    = y;
+    cloud->flip = flip;
+
+    grDamageCloud(cloudNo);
+}
+
+
+// Keep only the first numClouds clouds, e.g. 0 before the sprites they
+// point to are released
+
+void grSetNumClouds(int numClouds)
+{
+    for (int i=numClouds; i < grNumClouds; i++)
+        grDamageCloud(i);
+
+    grNumClouds = numClouds;
 }
 
 
@@ -504,6 +1031,8 @@ void grClearScreen(PlatformSurface *sfc)
     platformSetClipRect(sfc, NULL);
     platformFillRect(sfc, NULL, 0xa8, 0, 0xa8, 0);
     platformSetClipRect(sfc, &rect);
+    composeClearLayer(sfc);
+    grDamage(sfc, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 }
 
 
@@ -515,6 +1044,9 @@ void grLoadScreen(char *strArg)
     if (grSavedZonesLayer != NULL)
         grReleaseSavedLayer();
 
+    if (grWavesLayer != NULL)
+        grReleaseWavesLayer();
+
     struct TScrResource *scrResource = findScrResource(strArg);
 
     if ((scrResource->width % 2) == 1) {
@@ -528,18 +1060,12 @@ void grLoadScreen(char *strArg)
     uint16 width  = scrResource->width;
     uint16 height = scrResource->height;
 
-    uint8 *outData = safe_malloc(width * height * sizeof(uint32));
-
-    uint8 *inPtr  = scrResource->uncompressedData;
-    uint8 *outPtr = outData;
-
-    for (int inOffset=0; inOffset < width*height/2; inOffset++) {
-        memcpy(outPtr, ttmPalette[(inPtr[0] & 0xf0) >> 4] , 4); outPtr += 4;
-        memcpy(outPtr, ttmPalette[(inPtr[0] & 0x0f)     ] , 4); outPtr += 4;
-        inPtr++;
-    }
+    // Our own copy, as the background may then be drawn on
+    uint8 *outData = safe_malloc(width * height * grPixelSize);
+    memcpy(outData, grGetCachedScreen(scrResource), width * height * grPixelSize);
 
-    grBackgroundSfc = platformCreateSurfaceFrom((void*)outData, width, height, 4*width);
+    grBackgroundSfc = platformCreateSurfaceFrom((void*)outData, width, height, grPixelSize*width);
+    composeAddLayer(grBackgroundSfc);
 }
 
 
@@ -551,9 +1077,13 @@ void grInitEmptyBackground(void)
     if (grSavedZonesLayer != NULL)
         grReleaseSavedLayer();
 
-    uint8 *data = safe_malloc(SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32));
-    memset(data, 0, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32));
-    grBackgroundSfc = platformCreateSurfaceFrom((void*)data, SCREEN_WIDTH, SCREEN_HEIGHT, 4*SCREEN_WIDTH);
+    if (grWavesLayer != NULL)
+        grReleaseWavesLayer();
+
+    uint8 *data = safe_malloc(SCREEN_WIDTH * SCREEN_HEIGHT * grPixelSize);
+    memset(data, 0, SCREEN_WIDTH * SCREEN_HEIGHT * grPixelSize);
+    grBackgroundSfc = platformCreateSurfaceFrom((void*)data, SCREEN_WIDTH, SCREEN_HEIGHT, grPixelSize*SCREEN_WIDTH);
+    composeAddLayer(grBackgroundSfc);
 }
 
 
@@ -586,18 +1116,13 @@ void grLoadBmp(struct TTtmSlot *ttmSlot, uint16 slotNo, char *strArg)
         uint16 width  = bmpResource->widths[image];
         uint16 height = bmpResource->heights[image];
 
-        uint8 *outData = safe_malloc(width * height * sizeof(uint32));
-
-        uint8 *outPtr = outData;
+        uint8 *outData = safe_malloc(width * height * grPixelSize);
 
-        for (int inOffset=0; inOffset < (width*height/2); inOffset++) {
-            memcpy(outPtr, ttmPalette[(inPtr[0] & 0xf0) >> 4] , 4); outPtr += 4;
-            memcpy(outPtr, ttmPalette[(inPtr[0] & 0x0f)     ] , 4); outPtr += 4;
-            inPtr++;
-        }
+        grExpandPixels(outData, inPtr, width * height);
+        inPtr += width * height / 2;
 
         PlatformSurface *surface = platformCreateSurfaceFrom((void*)outData,
-                                               width, height, 4*width);
+                                               width, height, grPixelSize*width);
         platformSetColorKey(surface, 0xa8, 0, 0xa8);
         ttmSlot->sprites[slotNo][image] = surface;
     }
@@ -607,6 +1132,10 @@ void grLoadBmp(struct TTtmSlot *ttmSlot, uint16 slotNo, char *strArg)
 void grFadeOut(void)
 {
     static int fadeOutType = 0;
+
+    // The fade is drawn over the frame on screen
+    platformSyncWindowSurface(platform_window);
+
     PlatformSurface *sfc = platformGetWindowSurface(platform_window);
     PlatformSurface *tmpSfc = grNewLayer();
 
@@ -617,7 +1146,7 @@ void grFadeOut(void)
 
         // Circle from center
         case 0:
-            // Note: we use tmpSfc to be sure we have a 32bpp surface,
+            // Note: we use tmpSfc to be sure we have a surface in the layers' format,
             // which is needed by grDrawCircle()
             for (int radius=20; radius <= 400; radius += 20) {
                 grDrawCircle(tmpSfc, 320 - radius, 240 - radius,
@@ -668,6 +1197,9 @@ void grFadeOut(void)
 
     grFreeLayer(tmpSfc);
 
+    // We drew on the window surface behind the compositor's back
+    composeInvalidate();
+
     fadeOutType = (fadeOutType + 1) % 5;
 }
 
@@ -31,6 +31,7 @@
 #define MAX_SPRITES_PER_BMP 120
 #define MAX_TTM_SLOTS       10
 #define MAX_TTM_THREADS     10
+#define MAX_CLOUDS          5
 
 
 struct TAdsScene {
@@ -54,6 +55,13 @@ struct TTtmTag {  // TODO : rename, used for ADS too
     uint32 offset;
 };
 
+struct TGrSpriteRef {
+    uint16 imageNo;
+    uint16 spriteNo;
+    sint16 x;
+    sint16 y;
+};
+
 struct TTtmThread {
     struct TTtmSlot   *ttmSlot;
     int    isRunning;
@@ -76,6 +84,9 @@ extern PlatformSurface *grBackgroundSfc;
 extern int grDx;
 extern int grDy;
 extern int grWindowed;
+extern int grSmoothScaling;
+extern char *grWindowId;
+extern int grAllOutputs;
 extern int grUpdateDelay;
 
 
@@ -90,6 +101,7 @@ void grUpdateDisplay(struct TTtmThread *ttmBackgroundThread,
 
 PlatformSurface *grNewEmptyBackground(void);
 PlatformSurface *grNewLayer(void);
+PlatformSurface *grGetWavesLayer(void);
 void grFreeLayer(PlatformSurface *sfc);
 
 void grLoadBmp(struct TTtmSlot *ttmSlot, uint16 slotNo, char *strArg);
@@ -106,6 +118,10 @@ void grDrawRect(PlatformSurface *sfc, sint16 x, sint16 y, uint16 width, uint16 h
 void grDrawCircle(PlatformSurface *sfc, sint16 x1, sint16 y1, uint16 width, uint16 height, uint8 fgColor, uint8 bgColor);
 void grDrawSprite(PlatformSurface *sfc, struct TTtmSlot *ttmSlot, sint16 x, sint16 y, uint16 spriteNo, uint16 imageNo);
 void grDrawSpriteFlip(PlatformSurface *sfc, struct TTtmSlot *ttmSlot, sint16 x, sint16 y, uint16 spriteNo, uint16 imageNo);
+void grDrawSurface(PlatformSurface *sfc, PlatformSurface *srcSfc, sint16 x, sint16 y);
+PlatformSurface *grFlattenSprites(struct TTtmSlot *ttmSlot, struct TGrSpriteRef *sprites, int numSprites, sint16 *x, sint16 *y);
+void grSetCloud(int cloudNo, struct TTtmSlot *ttmSlot, sint16 x, sint16 y, uint16 spriteNo, uint16 imageNo, int flip);
+void grSetNumClouds(int numClouds);
 void grInitEmptyBackground(void);
 void grClearScreen(PlatformSurface *sfc);
 void grFadeOut(void);
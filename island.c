@@ -33,6 +33,66 @@
 struct TIslandState islandState = { 0, 0, 0, 0, 0, 0, 0, {0,0,0,0,0}, {0,0,0,0,0} };
 
 
+// The island, its palm tree, the low tide shore and the raft, flattened
+// once per (lowTide, raft) variant
+struct TIslandStack {
+    PlatformSurface *sfc;
+    sint16 x;
+    sint16 y;
+};
+
+static struct TIslandStack islandStacks[2][6];
+
+
+// Needs BACKGRND.BMP in BMP slot 0 of ttmSlot; uses slot 1 for MRAFT.BMP
+
+static void islandFlattenStack(struct TTtmSlot *ttmSlot, struct TIslandStack *stack, int lowTide, int raft)
+{
+    struct TGrSpriteRef sprites[7];
+    int numSprites = 0;
+
+    if (raft) {
+        grLoadBmp(ttmSlot, 1, "MRAFT.BMP");
+
+        sint16 xRaft = (lowTide ? 529 : 512);
+        sint16 yRaft = (lowTide ? 281 : 266);
+
+        sprites[numSprites++] = (struct TGrSpriteRef) { 1, raft - 1, xRaft, yRaft };   // raft-1 .. raft-5
+    }
+
+    sprites[numSprites++] = (struct TGrSpriteRef) { 0,  0, 288, 279 };      // island
+    sprites[numSprites++] = (struct TGrSpriteRef) { 0, 13, 442, 148 };      // trunk
+    sprites[numSprites++] = (struct TGrSpriteRef) { 0, 12, 365, 122 };      // leafs
+    sprites[numSprites++] = (struct TGrSpriteRef) { 0, 14, 396, 279 };      // palmtree's shadow
+
+    if (lowTide) {
+        sprites[numSprites++] = (struct TGrSpriteRef) { 0,  1, 249, 303 };  // low tide shore
+        sprites[numSprites++] = (struct TGrSpriteRef) { 0,  2, 150, 328 };  // rock
+    }
+
+    stack->sfc = grFlattenSprites(ttmSlot, sprites, numSprites, &stack->x, &stack->y);
+
+    if (raft)
+        grReleaseBmp(ttmSlot, 1);
+}
+
+
+// The stacks hold expanded pixels: to be released when the palette
+// changes, and at the end
+
+void islandReleaseStacks(void)
+{
+    for (int lowTide=0; lowTide < 2; lowTide++) {
+        for (int raft=0; raft < 6; raft++) {
+            if (islandStacks[lowTide][raft].sfc != NULL) {
+                platformFreeSurface(islandStacks[lowTide][raft].sfc);
+                islandStacks[lowTide][raft].sfc = NULL;
+            }
+        }
+    }
+}
+
+
 void islandInit(struct TTtmThread *ttmThread)
 {
     struct TTtmSlot *ttmSlot = ttmThread->ttmSlot;
@@ -49,26 +109,6 @@ void islandInit(struct TTtmThread *ttmThread)
 
     ttmThread->ttmLayer = grBackgroundSfc;
 
-    grDx = islandState.xPos;
-    grDy = islandState.yPos;
-
-
-    // Raft
-
-    grLoadBmp(ttmSlot, 0, "MRAFT.BMP");
-
-    sint32 xRaft = (islandState.lowTide ? 529 : 512);
-    sint32 yRaft = (islandState.lowTide ? 281 : 266);
-
-    switch (islandState.raft) {
-        case 1: grDrawSprite(grBackgroundSfc, ttmSlot, xRaft, yRaft, 0, 0); break;  // raft-1
-        case 2: grDrawSprite(grBackgroundSfc, ttmSlot, xRaft, yRaft, 1, 0); break;  // raft-2
-        case 3: grDrawSprite(grBackgroundSfc, ttmSlot, xRaft, yRaft, 2, 0); break;  // raft-3
-        case 4: grDrawSprite(grBackgroundSfc, ttmSlot, xRaft, yRaft, 3, 0); break;  // raft-4
-        case 5: grDrawSprite(grBackgroundSfc, ttmSlot, xRaft, yRaft, 4, 0); break;  // raft-5
-    }
-
-
     grLoadBmp(ttmSlot, 0, "BACKGRND.BMP");
 
 
@@ -111,17 +151,16 @@ void islandInit(struct TTtmThread *ttmThread)
     grDx = islandState.xPos;
     grDy = islandState.yPos;
 
-    // The island itself
+    // The island itself, and the raft
 
-    grDrawSprite(grBackgroundSfc, ttmSlot, 288, 279,  0, 0);      // island
-    grDrawSprite(grBackgroundSfc, ttmSlot, 442, 148, 13, 0);      // trunk
-    grDrawSprite(grBackgroundSfc, ttmSlot, 365, 122, 12, 0);      // leafs
-    grDrawSprite(grBackgroundSfc, ttmSlot, 396, 279, 14, 0);      // palmtree's shadow
+    int lowTide = (islandState.lowTide ? 1 : 0);
+    int raft = (islandState.raft >= 1 && islandState.raft <= 5 ? islandState.raft : 0);
+    struct TIslandStack *stack = &islandStacks[lowTide][raft];
 
-    if (islandState.lowTide) {
-        grDrawSprite(grBackgroundSfc, ttmSlot, 249, 303,  1, 0);  // low tide shore
-        grDrawSprite(grBackgroundSfc, ttmSlot, 150, 328,  2, 0);  // rock
-    }
+    if (stack->sfc == NULL)
+        islandFlattenStack(ttmSlot, stack, lowTide, raft);
+
+    grDrawSurface(grBackgroundSfc, stack->sfc, stack->x, stack->y);
 
     // Initial waves on the shore
     for (int i=0; i < 4; i++) {
@@ -138,6 +177,7 @@ void islandAnimate(struct TTtmThread *ttmThread)
     static sint32 counter2 = 0;
 
     struct TTtmSlot *ttmSlot = ttmThread->ttmSlot;
+    PlatformSurface *wavesLayer = grGetWavesLayer();
 
     grDx = islandState.xPos;
     grDy = islandState.yPos;
@@ -146,17 +186,17 @@ void islandAnimate(struct TTtmThread *ttmThread)
     if (islandState.lowTide) {
         counter2 %= 4;
         switch (counter2) {
-            case 0: grDrawSprite(grBackgroundSfc, ttmSlot, 129, 340, 39+counter1, 0); break;  // rock waves (40)
-            case 1: grDrawSprite(grBackgroundSfc, ttmSlot, 233, 323, 30+counter1, 0); break;  // low tide waves - left (31)
-            case 2: grDrawSprite(grBackgroundSfc, ttmSlot, 367, 356, 33+counter1, 0); break;  // low tide waves - center (33)
-            case 3: grDrawSprite(grBackgroundSfc, ttmSlot, 558, 323, 36+counter1, 0); break;  // low tide waves - right (36)
+            case 0: grDrawSprite(wavesLayer, ttmSlot, 129, 340, 39+counter1, 0); break;  // rock waves (40)
+            case 1: grDrawSprite(wavesLayer, ttmSlot, 233, 323, 30+counter1, 0); break;  // low tide waves - left (31)
+            case 2: grDrawSprite(wavesLayer, ttmSlot, 367, 356, 33+counter1, 0); break;  // low tide waves - center (33)
+            case 3: grDrawSprite(wavesLayer, ttmSlot, 558, 323, 36+counter1, 0); break;  // low tide waves - right (36)
         }
     } else {
         counter2 %= 3;
         switch (counter2) {
-            case 0: grDrawSprite(grBackgroundSfc, ttmSlot, 270, 306, 3+counter1, 0); break;  // high tide waves - left (3)
-            case 1: grDrawSprite(grBackgroundSfc, ttmSlot, 364, 319, 6+counter1, 0); break;  // high tide waves - center (6)
-            case 2: grDrawSprite(grBackgroundSfc, ttmSlot, 518, 303, 9+counter1, 0); break;  // high tide waves - right (9)
+            case 0: grDrawSprite(wavesLayer, ttmSlot, 270, 306, 3+counter1, 0); break;  // high tide waves - left (3)
+            case 1: grDrawSprite(wavesLayer, ttmSlot, 364, 319, 6+counter1, 0); break;  // high tide waves - center (6)
+            case 2: grDrawSprite(wavesLayer, ttmSlot, 518, 303, 9+counter1, 0); break;  // high tide waves - right (9)
         }
     }
 
@@ -194,10 +234,10 @@ void islandInitHoliday(struct TTtmThread *ttmThread) {
 
 void islandAnimateClouds(struct TTtmThread *ttmThread) {
     struct TTtmSlot *ttmSlot = ttmThread->ttmSlot;
-    grClearScreen(ttmThread->ttmLayer);
     if (islandState.clouds.numClouds > 0) {
         ttmThread->isRunning = 3;
-        grLoadBmp(ttmSlot, 0, "BACKGRND.BMP");
+        if (!ttmSlot->numSprites[0])
+            grLoadBmp(ttmSlot, 0, "BACKGRND.BMP");
 
         // animate clouds x position
         for (sint32 i=0; i < islandState.clouds.numClouds; i++) {
@@ -219,16 +259,14 @@ void islandAnimateClouds(struct TTtmThread *ttmThread) {
             }
 
             debugMsg("Clouds Pos: %d, %d", cloudX, cloudY);
-            if (islandState.clouds.windDirection) {
-                grDrawSprite(ttmThread->ttmLayer, ttmSlot, cloudX, cloudY, 15 + cloudNo, 0);
-            } else {
-                grDrawSpriteFlip(ttmThread->ttmLayer, ttmSlot, cloudX, cloudY, 15 + cloudNo, 0);
-            }
+            grSetCloud(i, ttmSlot, cloudX, cloudY, 15 + cloudNo, 0,
+                       !islandState.clouds.windDirection);
 
             islandState.clouds.xPos[i] = cloudX;
             islandState.clouds.yPos[i] = cloudY;
         }
     } else {
+        grSetNumClouds(0);
         ttmThread->isRunning = 0;
     }
 }
@@ -44,6 +44,7 @@ struct TIslandState {
 
 extern struct TIslandState islandState;
 
+void islandReleaseStacks(void);
 void islandInit(struct TTtmThread *ttmThread);
 void islandAnimate(struct TTtmThread *ttmThread);
 void islandInitHoliday(struct TTtmThread *ttmThread);
@@ -30,6 +30,7 @@
 #include "resource.h"
 #include "dump.h"
 #include "graphics.h"
+#include "compose.h"
 #include "events.h"
 #include "sound.h"
 #include "ttm.h"
@@ -62,10 +63,25 @@ static void usage(void)
         printf("\n");
         printf(" Available options are:\n");
         printf("         window     - play in windowed mode\n");
+        printf("         window-id <id> - play in an existing X window (also\n");
+        printf("                      taken from $XSCREENSAVER_WINDOW)\n");
         printf("         nosound    - quiet mode\n");
+        printf("         audioperiod <frames> - audio mixed that many frames at a time\n");
+        printf("         audioperiods <n>     - audio buffered that many periods ahead\n");
+        printf("         resample <nearest|linear|cubic> - how sounds are converted to\n");
+        printf("                      the audio device's rate, from fastest to best\n");
+        printf("         audioout <null|file.wav> - mix the audio into nothing, or a WAV\n");
+        printf("                      file, rather than play it\n");
+        printf("         audiotime <real|virtual> - for audioout: mix as the clock goes,\n");
+        printf("                      or as the engine's ticks go, however fast\n");
         printf("         island     - display the island as background for ADS play\n");
         printf("         debug      - print some debug info on stdout\n");
         printf("         hotkeys    - enable hot keys\n");
+        printf("         threads    - composite the screen on all CPU cores\n");
+        printf("         tiles      - composite the screen by tiles, only where it changed\n");
+        printf("         smooth     - smooth filtering when scaling to full screen\n");
+        printf("         adaptive   - don't draw the frames too late to be shown\n");
+        printf("         alloutputs - play on every monitor (X11)\n");
         printf("\n");
         printf(" While-playing hot-keys (if enabled):\n");
         printf("         Esc        - Terminate immediately\n");
@@ -123,9 +139,56 @@ static void parseArgs(int argc, char **argv)
             else if (!strcmp(argv[i], "window")) {
                 grWindowed = 1;
             }
+            else if (!strcmp(argv[i], "window-id") || !strcmp(argv[i], "-window-id")) {
+                if (++i == argc)
+                    usage();
+                grWindowId = argv[i];
+            }
             else if (!strcmp(argv[i], "nosound")) {
                 soundDisabled = 1;
             }
+            else if (!strcmp(argv[i], "audioperiod")) {
+                if (++i == argc || atoi(argv[i]) <= 0)
+                    usage();
+                soundPeriodSize = atoi(argv[i]);
+            }
+            else if (!strcmp(argv[i], "audioperiods")) {
+                if (++i == argc || atoi(argv[i]) < 2)
+                    usage();
+                soundNumPeriods = atoi(argv[i]);
+            }
+            else if (!strcmp(argv[i], "resample")) {
+                if (++i == argc)
+                    usage();
+                else if (!strcmp(argv[i], "nearest"))
+                    soundResampleQuality = RESAMPLE_NEAREST;
+                else if (!strcmp(argv[i], "linear"))
+                    soundResampleQuality = RESAMPLE_LINEAR;
+                else if (!strcmp(argv[i], "cubic"))
+                    soundResampleQuality = RESAMPLE_CUBIC;
+                else
+                    usage();
+            }
+            else if (!strcmp(argv[i], "audioout")) {
+                if (++i == argc)
+                    usage();
+                else if (!strcmp(argv[i], "null"))
+                    soundSink = SINK_NULL;
+                else {
+                    soundSink = SINK_WAV;
+                    soundSinkFilename = argv[i];
+                }
+            }
+            else if (!strcmp(argv[i], "audiotime")) {
+                if (++i == argc)
+                    usage();
+                else if (!strcmp(argv[i], "real"))
+                    soundVirtualTime = 0;
+                else if (!strcmp(argv[i], "virtual"))
+                    soundVirtualTime = 1;
+                else
+                    usage();
+            }
             else if (!strcmp(argv[i], "island")) {
                 argIsland = 1;
             }
@@ -135,6 +198,21 @@ static void parseArgs(int argc, char **argv)
             else if (!strcmp(argv[i], "hotkeys")) {
                 evHotKeysEnabled = 1;
             }
+            else if (!strcmp(argv[i], "threads")) {
+                composeNumThreads = -1;
+            }
+            else if (!strcmp(argv[i], "tiles")) {
+                composeTiles = 1;
+            }
+            else if (!strcmp(argv[i], "smooth")) {
+                grSmoothScaling = 1;
+            }
+            else if (!strcmp(argv[i], "adaptive")) {
+                evAdaptive = 1;
+            }
+            else if (!strcmp(argv[i], "alloutputs")) {
+                grAllOutputs = 1;
+            }
         }
     }
 
@@ -174,7 +252,14 @@ int main(int argc, char **argv)
 
     else if (argBench) {
         graphicsInit();
+
+        // The device isn't used for benchmarks, but a sink is
+        if (soundSink == SINK_DEVICE)
+            soundDisabled = 1;
+
+        soundInit();
         adsPlayBench();
+        soundEnd();
         graphicsEnd();
     }
 
@@ -89,10 +89,17 @@ void platformShutdown(void);
 
 // Graphics - Window management
 PlatformWindow* platformCreateWindow(const char* title, int width, int height, int fullscreen);
+PlatformWindow* platformAdoptWindow(const char* windowId, int width, int height);
 void platformDestroyWindow(PlatformWindow* window);
 void platformShowCursor(int show);
 void platformToggleFullscreen(PlatformWindow* window);
+void platformSetScaleFilter(int smooth);
+void platformSetAllOutputs(int all);
 void platformUpdateWindow(PlatformWindow* window);
+void platformRefreshWindow(PlatformWindow* window);
+void platformPresentWindow(PlatformWindow* window);
+void platformSyncWindowSurface(PlatformWindow* window);
+int platformIsWindowVisible(PlatformWindow* window);
 PlatformSurface* platformGetWindowSurface(PlatformWindow* window);
 
 // Graphics - Surface management
@@ -108,6 +115,7 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
 void platformFillRect(PlatformSurface* surface, PlatformRect* rect,
                      uint8 r, uint8 g, uint8 b, uint8 a);
 void platformSetColorKey(PlatformSurface* surface, uint8 r, uint8 g, uint8 b);
+int platformGetColorKey(PlatformSurface* surface, uint8* r, uint8* g, uint8* b);
 void platformSetClipRect(PlatformSurface* surface, PlatformRect* rect);
 void platformGetClipRect(PlatformSurface* surface, PlatformRect* rect);
 uint32 platformMapRGB(PlatformSurface* surface, uint8 r, uint8 g, uint8 b);
@@ -118,36 +126,63 @@ int platformGetSurfacePitch(PlatformSurface* surface);
 int platformGetSurfaceWidth(PlatformSurface* surface);
 int platformGetSurfaceHeight(PlatformSurface* surface);
 int platformGetSurfaceBytesPerPixel(PlatformSurface* surface);
+// Of every surface: 4 (BGRX), or 2 (RGB565) where the display is 16-bit.
+// Known once the window is created.
+int platformGetPixelSize(void);
 
 // Events
 int platformPollEvent(PlatformEvent* event);
 
-// Timing
+// Timing. Deadlines are platformGetMicros() times.
+#define PLATFORM_NO_DEADLINE 0xffffffffffffffffULL
+
 uint32 platformGetTicks(void);
+uint64 platformGetMicros(void);
 void platformDelay(uint32 ms);
+void platformWaitEvent(uint64 deadline);
 
 // Audio
-typedef void (*PlatformAudioCallback)(void* userdata, uint8* stream, int len);
+// Returns 0 when it had nothing to play, and filled the stream with silence
+typedef int (*PlatformAudioCallback)(void* userdata, uint8* stream, int len);
 
+// platformOpenAudio() may change freq and channels to what the device
+// plays natively: the caller is expected to provide samples as such
 typedef struct {
     int freq;
-    uint16 format;
+    uint16 format;              // Bits per sample: 8 unsigned, 16 signed
     uint8 channels;
-    uint16 samples;
+    uint16 samples;             // Per callback, i.e. per period
+    uint16 periods;             // In the device's buffer, 0 for the default
     PlatformAudioCallback callback;
     void* userdata;
 } PlatformAudioSpec;
 
+typedef struct {
+    uint32 periodSize;          // Frames, as granted by the device
+    uint32 bufferSize;          // Frames
+    uint32 bufferLatency;       // us, for a full buffer
+    uint32 latency;             // us, measured on average
+    uint32 maxLatency;          // us
+    uint32 numXruns;
+    uint32 numSuspends;         // Times the stream was stopped, being idle
+} PlatformAudioStats;
+
 int platformInitAudio(void);
 void platformCloseAudio(void);
 int platformOpenAudio(PlatformAudioSpec* spec);
 void platformPauseAudio(int pause);
 void platformLockAudio(void);
 void platformUnlockAudio(void);
+void platformWakeAudio(void);
+int platformGetAudioStats(PlatformAudioStats* stats);
 int platformLoadWAV(const char* filename, PlatformAudioSpec* spec,
                     uint8** audio_buf, uint32* audio_len);
 void platformFreeWAV(uint8* audio_buf);
 
+// Files - read-only, shared with the page cache where possible
+uint8* platformMapFile(const char* filename, uint32* size);
+void platformUnmapFile(uint8* data, uint32 size);
+
 // Platform-specific error reporting
 const char* platformGetError(void);
 
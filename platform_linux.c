@@ -11,14 +11,43 @@
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+#ifdef HAVE_XPRESENT
+// No client library for Present is assumed: the few requests used are
+// built by hand, the way extension libraries do it
+#include <X11/Xlibint.h>
+#include <X11/extensions/Xge.h>
+#include <X11/extensions/presentproto.h>
+#endif
+#ifdef HAVE_XDPMS
+#include <X11/extensions/dpms.h>
+#endif
+#ifdef HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
 #include <alsa/asoundlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static const char* lastError = "";
 static Display* display = NULL;
 static struct timespec startTime;
+static int timerFd = -1;
 
 // Surface structure
 struct PlatformSurface {
@@ -29,99 +58,1454 @@ struct PlatformSurface {
     uint8* pixels;
     uint8 hasColorKey;
     uint8 colorKeyR, colorKeyG, colorKeyB;
+    uint16 colorKeyPixel;   // RGB565 surfaces
     PlatformRect clipRect;
     int ownPixels;
 };
 
+// Pixel layout expected by the X server for the window's visual
+typedef struct {
+    int bitsPerPixel;
+    int msbFirst;
+    uint32 redMask, greenMask, blueMask;
+} PresentFormat;
+
+typedef void (*PresentConvertFunc)(PlatformWindow* window, PlatformSurface* src);
+
+#ifdef HAVE_XPRESENT
+#define PRESENT_NUM_PIXMAPS 3
+
+// A pixmap frames are presented from. It can't be drawn in again
+// before the server tells it's idle.
+typedef struct {
+    Pixmap pixmap;
+    int busy;
+    uint32 serial;
+    uint64_t targetMsc;
+} PresentSlot;
+#endif
+
 // Window structure
 struct PlatformWindow {
     Window window;
     GC gc;
     XImage* ximage;
+    PresentFormat format;
+    PresentConvertFunc convert;   // NULL when the XImage uses the surface's pixels
+    uint8* presentPixels;
+    int presentPitch;
+    Visual* visual;
+    int depth;
+    int clientWidth, clientHeight;
+    int clearBorders;
+    // Frames are pushed on a connection of their own (with 'gc'), so
+    // that the present thread never contends with the event loop for Xlib
+    Display* presentDisplay;
+    int presentWidth, presentHeight;   // Client size, as of the frame being pushed
+    int presentClearBorders;
+    // Double buffering. The engine draws in 'surface' while the present
+    // thread pushes 'frontSurface'; both are swapped at each handoff.
+    PlatformSurface* frontSurface;
+    pthread_t presentThread;
+    pthread_mutex_t presentMutex;
+    pthread_cond_t presentCond;
+    int presentThreadRunning;
+    int presentRequested;
+    int presentBusy;
+    int presentQuit;
+    // Scaled presentation, when the window is larger than the surface
+    XImage* scaledImage;
+    uint8* scaleScratch;
+    int scaledX, scaledY;
+    int scaledSmooth;
+#ifdef HAVE_XPRESENT
+    // Vsync-aligned presentation, when the server has Present
+    int presentOpcode;
+    PresentSlot presentSlots[PRESENT_NUM_PIXMAPS];
+    int presentPixmapWidth, presentPixmapHeight;
+    uint32 presentSerial;
+    uint64_t lastMsc, lastUst, mscInterval;   // UST in microseconds
+    int numPresented, numMissed;
+#endif
+#ifdef HAVE_XSHM
+    XShmSegmentInfo shmInfo;
+    int useShm;
+    int shmPending;
+#endif
     PlatformSurface* surface;
     int isFullscreen;
+    int isForeign;   // Adopted, not created by us
     Atom wmDeleteWindow;
+    // With all outputs in use, the frames drawn in the primary window are
+    // also shown by one more window per monitor, each with its own present
+    // thread. These have no buffers of their own: 'surface' is only there
+    // for its size, and 'frontSurface' is the primary's.
+    PlatformWindow* primary;   // NULL for the window the engine draws in
+    PlatformWindow* nextOutput;
+    // Can anybody see the window ? The DPMS state costs a round trip,
+    // and is only asked every DPMS_CHECK_INTERVAL.
+    int isMapped;
+    int isObscured;
+    int hasDpms;
+    int dpmsOff;
+    uint32 dpmsCheckTime;
 };
 
-static PlatformWindow* mainWindow = NULL;
+#define DPMS_CHECK_INTERVAL 1000   // ms
+
+static PlatformWindow* mainWindow = NULL;
+static int scaleSmooth = 0;
+static int surfacePixelSize = 4;   // BGRX, or RGB565 on a 16-bit display
+static int allOutputs = 0;
+
+#define MAX_OUTPUTS 8
+
+// Where a window goes when all outputs are used
+typedef struct {
+    int screen;
+    int x, y;
+    int width, height;
+} OutputRect;
+
+// Initialize platform
+int platformInit(void) {
+    XInitThreads();
+    display = XOpenDisplay(NULL);
+    if (!display) {
+        lastError = "Failed to open X display";
+        return -1;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return 0;
+}
+
+void platformShutdown(void) {
+    if (timerFd >= 0) {
+        close(timerFd);
+        timerFd = -1;
+    }
+    if (display) {
+        XCloseDisplay(display);
+        display = NULL;
+    }
+}
+
+// Conversion of the window surface to the server's pixel format.
+// Everything is converted on our side, in the server's byte order, so
+// that XPutImage() never falls back to Xlib's per-pixel conversion.
+// On a 565 display, the surfaces themselves are 565 and nothing is
+// converted, except for outputs on another screen with another format.
+
+static int maskShift(uint32 mask) {
+    int shift = 0;
+    while (mask && !(mask & 1)) { mask >>= 1; shift++; }
+    return shift;
+}
+
+static int maskBits(uint32 mask) {
+    int bits = 0;
+    for (mask >>= maskShift(mask); mask & 1; mask >>= 1) bits++;
+    return bits;
+}
+
+static int hostIsLsbFirst(void) {
+    uint16 one = 1;
+    return *(uint8*)&one;
+}
+
+// Any TrueColor format with 16, 24 or 32 bits per pixel, from either
+// surface format
+static void convertGeneric(PlatformWindow* window, PlatformSurface* src) {
+    PresentFormat* f = &window->format;
+    int bytesPerPixel = f->bitsPerPixel / 8;
+    int shifts[3] = { maskShift(f->redMask), maskShift(f->greenMask), maskShift(f->blueMask) };
+    int bits[3] = { maskBits(f->redMask), maskBits(f->greenMask), maskBits(f->blueMask) };
+    
+    for (int y = 0; y < src->height; y++) {
+        const uint8* in = src->pixels + y * src->pitch;
+        uint8* out = window->presentPixels + y * window->presentPitch;
+        
+        for (int x = 0; x < src->width; x++, in += src->bytesPerPixel, out += bytesPerPixel) {
+            uint8 rgb[3];
+            uint32 v = 0;
+            
+            if (src->bytesPerPixel == 2) {
+                uint16 p = *(const uint16*)in;
+                rgb[0] = ((p >> 8) & 0xf8) | (p >> 13);
+                rgb[1] = ((p >> 3) & 0xfc) | ((p >> 9) & 0x03);
+                rgb[2] = ((p << 3) & 0xf8) | ((p >> 2) & 0x07);
+            } else {
+                rgb[0] = in[2];
+                rgb[1] = in[1];
+                rgb[2] = in[0];
+            }
+            
+            for (int c = 0; c < 3; c++) {
+                uint32 channel = rgb[c];
+                channel = (bits[c] <= 8 ? channel >> (8 - bits[c]) : channel << (bits[c] - 8));
+                v |= channel << shifts[c];
+            }
+            
+            for (int i = 0; i < bytesPerPixel; i++)
+                out[f->msbFirst ? bytesPerPixel - 1 - i : i] = (uint8)(v >> (8 * i));
+        }
+    }
+}
+
+// XRGB with the server in big-endian order: reverse the bytes
+static void convertSwap32(PlatformWindow* window, PlatformSurface* src) {
+    
+    for (int y = 0; y < src->height; y++) {
+        const uint32* in = (const uint32*)(src->pixels + y * src->pitch);
+        uint32* out = (uint32*)(window->presentPixels + y * window->presentPitch);
+        int x = 0;
+        
+#ifdef __SSE2__
+        for (; x + 4 <= src->width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(in + x));
+            __m128i t = _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8));
+            t = _mm_shufflelo_epi16(t, _MM_SHUFFLE(2, 3, 0, 1));
+            t = _mm_shufflehi_epi16(t, _MM_SHUFFLE(2, 3, 0, 1));
+            _mm_storeu_si128((__m128i*)(out + x), t);
+        }
+#endif
+        for (; x < src->width; x++) {
+            uint32 p = in[x];
+            out[x] = (p >> 24) | ((p >> 8) & 0xff00) | ((p << 8) & 0xff0000) | (p << 24);
+        }
+    }
+}
+
+// BGRX to RGB565, little-endian host and server
+static void convert565(PlatformWindow* window, PlatformSurface* src) {
+    
+    for (int y = 0; y < src->height; y++) {
+        const uint32* in = (const uint32*)(src->pixels + y * src->pitch);
+        uint16* out = (uint16*)(window->presentPixels + y * window->presentPitch);
+        int x = 0;
+        
+#ifdef __SSE2__
+        const __m128i redMask   = _mm_set1_epi32(0xf800);
+        const __m128i greenMask = _mm_set1_epi32(0x07e0);
+        const __m128i blueMask  = _mm_set1_epi32(0x001f);
+        const __m128i bias32    = _mm_set1_epi32(0x8000);
+        const __m128i bias16    = _mm_set1_epi16((short)0x8000);
+        
+        for (; x + 8 <= src->width; x += 8) {
+            __m128i v[2];
+            
+            for (int i = 0; i < 2; i++) {
+                __m128i p = _mm_loadu_si128((const __m128i*)(in + x + 4 * i));
+                v[i] = _mm_or_si128(_mm_or_si128(
+                           _mm_and_si128(_mm_srli_epi32(p, 8), redMask),
+                           _mm_and_si128(_mm_srli_epi32(p, 5), greenMask)),
+                           _mm_and_si128(_mm_srli_epi32(p, 3), blueMask));
+                v[i] = _mm_sub_epi32(v[i], bias32);   // Keep packs from saturating
+            }
+            
+            __m128i packed = _mm_xor_si128(_mm_packs_epi32(v[0], v[1]), bias16);
+            _mm_storeu_si128((__m128i*)(out + x), packed);
+        }
+#endif
+        for (; x < src->width; x++) {
+            uint32 p = in[x];
+            out[x] = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+        }
+    }
+}
+
+static void queryPresentFormat(PresentFormat* f, Visual* visual, int depth) {
+    int numFormats;
+    
+    f->bitsPerPixel = 0;
+    f->msbFirst = (ImageByteOrder(display) == MSBFirst);
+    f->redMask = visual->red_mask;
+    f->greenMask = visual->green_mask;
+    f->blueMask = visual->blue_mask;
+    
+    XPixmapFormatValues* formats = XListPixmapFormats(display, &numFormats);
+    for (int i = 0; formats && i < numFormats; i++) {
+        if (formats[i].depth == depth)
+            f->bitsPerPixel = formats[i].bits_per_pixel;
+    }
+    if (formats) XFree(formats);
+}
+
+static int isPresentFormat565(PresentFormat* f, Visual* visual) {
+    return visual->class == TrueColor && f->bitsPerPixel == 16
+           && f->redMask == 0xf800 && f->greenMask == 0x07e0 && f->blueMask == 0x001f
+           && !f->msbFirst && hostIsLsbFirst();
+}
+
+static void platformCreatePresentImage(PlatformWindow* window, Visual* visual, int depth) {
+    PlatformSurface* surface = window->surface;
+    PresentFormat* f = &window->format;
+    
+    queryPresentFormat(f, visual, depth);
+    
+    window->convert = NULL;
+    window->presentPixels = NULL;
+    window->presentPitch = surface->pitch;
+    
+    int isXrgb = (f->redMask == 0xff0000 && f->greenMask == 0xff00 && f->blueMask == 0xff);
+    int is565 = isPresentFormat565(f, visual);
+    
+    if (surface->bytesPerPixel == 2) {
+        if (!is565)
+            window->convert = convertGeneric;
+    }
+    else if (visual->class != TrueColor
+        || (f->bitsPerPixel != 16 && f->bitsPerPixel != 24 && f->bitsPerPixel != 32)) {
+        fprintf(stderr, "Warning: unsupported X visual (depth %d, %d bpp), "
+                "leaving the conversion to Xlib\n", depth, f->bitsPerPixel);
+    }
+    else if (f->bitsPerPixel == 32 && isXrgb) {
+        if (f->msbFirst)
+            window->convert = convertSwap32;
+    }
+    else if (is565) {
+        window->convert = convert565;
+    }
+    else {
+        window->convert = convertGeneric;
+    }
+    
+    if (window->convert) {
+        window->presentPitch = ((surface->width * f->bitsPerPixel / 8) + 3) & ~3;
+        window->presentPixels = (uint8*)malloc(window->presentPitch * surface->height);
+    }
+    
+    window->visual = visual;
+    window->depth = depth;
+    window->ximage = XCreateImage(display, visual, depth, ZPixmap, 0,
+                                  (char*)(window->convert ? window->presentPixels : surface->pixels),
+                                  surface->width, surface->height, 32, window->presentPitch);
+}
+
+// Scaled presentation. The frame, already in the server's format, is
+// enlarged into a second image: by an integer factor with nearest
+// neighbor, or to the largest size keeping the aspect ratio with a
+// bilinear filter (24 and 32 bpp only). Either way it is centered, with
+// black borders.
+
+#ifdef HAVE_XSHM
+static int shmError;
+
+static int shmErrorHandler(Display* d, XErrorEvent* e) {
+    shmError = 1;
+    return 0;
+}
+
+// Outputs may share a connection: each waits for its own segment
+static Bool isShmCompletion(Display* d, XEvent* e, XPointer arg) {
+    return e->type == XShmGetEventBase(d) + ShmCompletion
+           && ((XShmCompletionEvent*)e)->shmseg == ((XShmSegmentInfo*)arg)->shmseg;
+}
+#endif
+
+static void freeScaledImage(PlatformWindow* window) {
+    if (!window->scaledImage) return;
+    
+#ifdef HAVE_XSHM
+    if (window->useShm) {
+        if (window->shmPending) {
+            XEvent xev;
+            XIfEvent(window->presentDisplay, &xev, isShmCompletion, (XPointer)&window->shmInfo);
+        }
+        XShmDetach(window->presentDisplay, &window->shmInfo);
+        shmdt(window->shmInfo.shmaddr);
+        window->scaledImage->data = NULL;
+        window->useShm = window->shmPending = 0;
+    }
+#endif
+    XDestroyImage(window->scaledImage);
+    window->scaledImage = NULL;
+    free(window->scaleScratch);
+    window->scaleScratch = NULL;
+}
+
+static void createScaledImage(PlatformWindow* window, int width, int height) {
+    int bytesPerPixel = window->format.bitsPerPixel / 8;
+    
+#ifdef HAVE_XSHM
+    // Only for a local server, and only if it really lets us attach
+    const char* name = DisplayString(window->presentDisplay);
+    
+    if (XShmQueryExtension(window->presentDisplay) && name && name[0] == ':') {
+        window->scaledImage = XShmCreateImage(window->presentDisplay, window->visual,
+                                              window->depth, ZPixmap, NULL,
+                                              &window->shmInfo, width, height);
+        if (window->scaledImage) {
+            window->shmInfo.shmid = shmget(IPC_PRIVATE,
+                                           window->scaledImage->bytes_per_line * height,
+                                           IPC_CREAT | 0600);
+            window->shmInfo.shmaddr = window->scaledImage->data =
+                (window->shmInfo.shmid < 0 ? (char*)-1 : (char*)shmat(window->shmInfo.shmid, NULL, 0));
+            window->shmInfo.readOnly = False;
+            
+            if (window->shmInfo.shmaddr != (char*)-1) {
+                XErrorHandler previousHandler = XSetErrorHandler(shmErrorHandler);
+                shmError = 0;
+                XShmAttach(window->presentDisplay, &window->shmInfo);
+                XSync(window->presentDisplay, False);
+                XSetErrorHandler(previousHandler);
+                shmctl(window->shmInfo.shmid, IPC_RMID, NULL);
+                
+                if (!shmError) {
+                    window->useShm = 1;
+                    window->shmPending = 0;
+                    return;
+                }
+                shmdt(window->shmInfo.shmaddr);
+            }
+            else if (window->shmInfo.shmid >= 0) {
+                shmctl(window->shmInfo.shmid, IPC_RMID, NULL);
+            }
+            
+            window->scaledImage->data = NULL;
+            XDestroyImage(window->scaledImage);
+        }
+    }
+    window->useShm = 0;
+#endif
+    
+    int pitch = ((width * bytesPerPixel) + 3) & ~3;
+    window->scaledImage = XCreateImage(window->presentDisplay, window->visual, window->depth, ZPixmap, 0,
+                                       (char*)malloc(pitch * height),
+                                       width, height, 32, pitch);
+}
+
+// One band of rows of a scaling pass; big images are split across
+// several threads.
+typedef struct ScaleJob {
+    const uint8* src;
+    int srcPitch, srcWidth, srcHeight;
+    XImage* dst;
+    int bytesPerPixel;
+    int factor;             // Nearest neighbor
+    uint8* scratch;         // Bilinear: source rows stretched horizontally
+    const int* xOffsets;
+    const int* xWeights;
+    void (*pass)(struct ScaleJob* job, int first, int last);
+    int first, last;
+} ScaleJob;
+
+#define MAX_SCALE_THREADS 4
+
+// The bands are handed to workers started on first use and kept until
+// the window is destroyed. With several outputs, one present thread has
+// the pool at a time: the others scale on their own meanwhile, instead
+// of waiting for it, so that the outputs are scaled side by side.
+static pthread_mutex_t scalePassMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t scaleMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scaleStartCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t scaleDoneCond = PTHREAD_COND_INITIALIZER;
+static pthread_t scaleThreads[MAX_SCALE_THREADS];
+static ScaleJob scaleBands[MAX_SCALE_THREADS];
+static uint32 scaleGeneration = 0;
+static int scaleNumPending = 0;
+static int scaleNumWorkers = -1;    // Not started yet
+static int scaleQuit = 0;
+
+static void* scaleWorker(void* arg) {
+    ScaleJob* band = &scaleBands[(intptr_t)arg];
+    uint32 generation = 0;
+    
+    while (1) {
+        pthread_mutex_lock(&scaleMutex);
+        while (!scaleQuit && scaleGeneration == generation)
+            pthread_cond_wait(&scaleStartCond, &scaleMutex);
+        if (scaleQuit) {
+            pthread_mutex_unlock(&scaleMutex);
+            break;
+        }
+        generation = scaleGeneration;
+        pthread_mutex_unlock(&scaleMutex);
+        
+        band->pass(band, band->first, band->last);
+        
+        pthread_mutex_lock(&scaleMutex);
+        if (--scaleNumPending == 0)
+            pthread_cond_signal(&scaleDoneCond);
+        pthread_mutex_unlock(&scaleMutex);
+    }
+    return NULL;
+}
+
+static void startScaleWorkers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int numThreads = (cpus < 1 ? 1 : cpus > MAX_SCALE_THREADS ? MAX_SCALE_THREADS : (int)cpus);
+    
+    // The calling thread scales the first band itself
+    scaleNumWorkers = 0;
+    scaleQuit = 0;
+    for (int i = 1; i < numThreads; i++) {
+        if (pthread_create(&scaleThreads[scaleNumWorkers], NULL, scaleWorker,
+                           (void*)(intptr_t)(scaleNumWorkers + 1))) {
+            fprintf(stderr, "Warning: could only start %d scaling threads\n", scaleNumWorkers);
+            break;
+        }
+        scaleNumWorkers++;
+    }
+}
+
+static void stopScaleWorkers(void) {
+    pthread_mutex_lock(&scalePassMutex);
+    if (scaleNumWorkers > 0) {
+        pthread_mutex_lock(&scaleMutex);
+        scaleQuit = 1;
+        pthread_cond_broadcast(&scaleStartCond);
+        pthread_mutex_unlock(&scaleMutex);
+        
+        for (int i = 0; i < scaleNumWorkers; i++)
+            pthread_join(scaleThreads[i], NULL);
+    }
+    scaleNumWorkers = -1;
+    scaleGeneration = 0;
+    pthread_mutex_unlock(&scalePassMutex);
+}
+
+static void runScalePass(ScaleJob* job, void (*pass)(ScaleJob*, int, int), int numRows) {
+    job->pass = pass;
+    
+    // Not worth it for the small images
+    if (job->dst->width * job->dst->height < 1000000) {
+        pass(job, 0, numRows);
+        return;
+    }
+    
+    if (pthread_mutex_trylock(&scalePassMutex)) {
+        pass(job, 0, numRows);
+        return;
+    }
+    
+    if (scaleNumWorkers < 0)
+        startScaleWorkers();
+    
+    int n = scaleNumWorkers + 1;
+    
+    pthread_mutex_lock(&scaleMutex);
+    for (int i = 1; i < n; i++) {
+        scaleBands[i] = *job;
+        scaleBands[i].first = numRows * i / n;
+        scaleBands[i].last = numRows * (i + 1) / n;
+    }
+    scaleNumPending = scaleNumWorkers;
+    scaleGeneration++;
+    pthread_cond_broadcast(&scaleStartCond);
+    pthread_mutex_unlock(&scaleMutex);
+    
+    pass(job, 0, numRows / n);
+    
+    // Barrier: a pass reads what the previous one wrote
+    pthread_mutex_lock(&scaleMutex);
+    while (scaleNumPending)
+        pthread_cond_wait(&scaleDoneCond, &scaleMutex);
+    pthread_mutex_unlock(&scaleMutex);
+    
+    pthread_mutex_unlock(&scalePassMutex);
+}
+
+// Works on any pixel size
+static void scaleNearestRows(ScaleJob* job, int first, int last) {
+    int factor = job->factor;
+    int bytesPerPixel = job->bytesPerPixel;
+    XImage* dst = job->dst;
+    
+    for (int y = first; y < last; y++) {
+        const uint8* in = job->src + y * job->srcPitch;
+        uint8* out = (uint8*)dst->data + y * factor * dst->bytes_per_line;
+        
+        if (bytesPerPixel == 4) {
+            const uint32* in32 = (const uint32*)in;
+            uint32* out32 = (uint32*)out;
+            
+            for (int x = 0; x < job->srcWidth; x++) {
+                uint32 p = in32[x];
+                for (int i = 0; i < factor; i++)
+                    *out32++ = p;
+            }
+        }
+        else if (bytesPerPixel == 2) {
+            const uint16* in16 = (const uint16*)in;
+            uint16* out16 = (uint16*)out;
+            
+            for (int x = 0; x < job->srcWidth; x++) {
+                uint16 p = in16[x];
+                for (int i = 0; i < factor; i++)
+                    *out16++ = p;
+            }
+        }
+        else {
+            uint8* o = out;
+            for (int x = 0; x < job->srcWidth; x++, in += bytesPerPixel) {
+                for (int i = 0; i < factor; i++, o += bytesPerPixel)
+                    memcpy(o, in, bytesPerPixel);
+            }
+        }
+        
+        // The other rows of the block are plain copies
+        for (int i = 1; i < factor; i++)
+            memcpy(out + i * dst->bytes_per_line, out, job->srcWidth * factor * bytesPerPixel);
+    }
+}
+
+static void scaleNearest(const uint8* src, int srcPitch, int srcWidth, int srcHeight,
+                         XImage* dst, int factor, int bytesPerPixel) {
+    ScaleJob job = { src, srcPitch, srcWidth, srcHeight, dst, bytesPerPixel, factor };
+    runScalePass(&job, scaleNearestRows, srcHeight);
+}
+
+// Per-byte bilinear filter, which suits any layout with 8-bit channels.
+// Each source row is first stretched horizontally into the scratch
+// buffer (dst->width x srcHeight pixels), then each output row is a
+// blend of two of those. Weights have 7 bits, so that the products of
+// two pixels fit signed 16-bit lanes for pmaddwd.
+
+static int bilinearSource(int i, int dstSize, int srcSize, int* weight) {
+    int s = (int)(((int64_t)i * 2 + 1) * srcSize * 128 / (dstSize * 2)) - 64;
+    if (s < 0) s = 0;
+    if (s > (srcSize - 1) * 128) s = (srcSize - 1) * 128;
+    int s0 = s >> 7;
+    if (s0 > srcSize - 2) s0 = srcSize - 2;
+    *weight = s - s0 * 128;
+    return s0;
+}
+
+static void bilinearHorizontalRows(ScaleJob* job, int first, int last) {
+    int dstWidth = job->dst->width;
+    int bytesPerPixel = job->bytesPerPixel;
+    const int* xOffsets = job->xOffsets;
+    const int* xWeights = job->xWeights;
+    
+    for (int y = first; y < last; y++) {
+        const uint8* in = job->src + y * job->srcPitch;
+        uint8* out = job->scratch + y * dstWidth * bytesPerPixel;
+        int x = 0;
+        
+#ifdef __SSE2__
+        if (bytesPerPixel == 4) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i round = _mm_set1_epi32(64);
+            
+            for (; x + 2 <= dstWidth; x += 2) {
+                __m128i r[2];
+                
+                for (int k = 0; k < 2; k++) {
+                    // Two neighbor pixels, as a0 b0 a1 b1 a2 b2 a3 b3
+                    __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(in + xOffsets[x + k])), zero);
+                    __m128i ab = _mm_unpacklo_epi16(v, _mm_srli_si128(v, 8));
+                    __m128i w = _mm_set1_epi32((xWeights[x + k] << 16) | (128 - xWeights[x + k]));
+                    r[k] = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(ab, w), round), 7);
+                }
+                
+                __m128i packed = _mm_packs_epi32(r[0], r[1]);
+                _mm_storel_epi64((__m128i*)(out + x * 4), _mm_packus_epi16(packed, packed));
+            }
+        }
+#endif
+        for (; x < dstWidth; x++) {
+            const uint8* a = in + xOffsets[x];
+            const uint8* b = a + bytesPerPixel;
+            int fx = xWeights[x];
+            
+            for (int c = 0; c < bytesPerPixel; c++)
+                out[x * bytesPerPixel + c] = (uint8)((a[c] * (128 - fx) + b[c] * fx + 64) >> 7);
+        }
+    }
+}
+
+static void bilinearVerticalRows(ScaleJob* job, int first, int last) {
+    XImage* dst = job->dst;
+    int rowBytes = dst->width * job->bytesPerPixel;
+    
+    for (int y = first; y < last; y++) {
+        int fy;
+        int y0 = bilinearSource(y, dst->height, job->srcHeight, &fy);
+        const uint8* rowA = job->scratch + y0 * rowBytes;
+        const uint8* rowB = rowA + rowBytes;
+        uint8* out = (uint8*)dst->data + y * dst->bytes_per_line;
+        int i = 0;
+        
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i wa = _mm_set1_epi16(128 - fy);
+        const __m128i wb = _mm_set1_epi16(fy);
+        const __m128i round = _mm_set1_epi16(64);
+        
+        for (; i + 16 <= rowBytes; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(rowA + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(rowB + i));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), wa),
+                                       _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wb));
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), wa),
+                                       _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wb));
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 7);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 7);
+            _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; i < rowBytes; i++)
+            out[i] = (uint8)((rowA[i] * (128 - fy) + rowB[i] * fy + 64) >> 7);
+    }
+}
+
+static void scaleBilinear(const uint8* src, int srcPitch, int srcWidth, int srcHeight,
+                          XImage* dst, int bytesPerPixel, uint8* scratch) {
+    int* xOffsets = (int*)malloc(dst->width * sizeof(int));
+    int* xWeights = (int*)malloc(dst->width * sizeof(int));
+    
+    for (int x = 0; x < dst->width; x++)
+        xOffsets[x] = bilinearSource(x, dst->width, srcWidth, &xWeights[x]) * bytesPerPixel;
+    
+    ScaleJob job = { src, srcPitch, srcWidth, srcHeight, dst, bytesPerPixel, 0,
+                     scratch, xOffsets, xWeights };
+    runScalePass(&job, bilinearHorizontalRows, srcHeight);
+    runScalePass(&job, bilinearVerticalRows, dst->height);
+    
+    free(xOffsets);
+    free(xWeights);
+}
+
+// Works out where the frame goes, and returns 1 if it first has to be
+// enlarged into window->scaledImage
+static int updateScaledImage(PlatformWindow* window) {
+    int srcWidth = window->surface->width;
+    int srcHeight = window->surface->height;
+    int clientWidth = window->presentWidth;
+    int clientHeight = window->presentHeight;
+    int smooth = scaleSmooth && window->format.bitsPerPixel >= 24;
+    int width, height;
+    
+    int factor = clientWidth / srcWidth;
+    if (clientHeight / srcHeight < factor)
+        factor = clientHeight / srcHeight;
+    
+    if (factor < 1) {
+        width = srcWidth;
+        height = srcHeight;
+    } else if (smooth) {
+        if (clientWidth * srcHeight > clientHeight * srcWidth) {
+            height = clientHeight;
+            width = clientHeight * srcWidth / srcHeight;
+        } else {
+            width = clientWidth;
+            height = clientWidth * srcHeight / srcWidth;
+        }
+    } else {
+        width = srcWidth * factor;
+        height = srcHeight * factor;
+    }
+    
+    window->scaledX = (factor < 1 ? 0 : (clientWidth - width) / 2);
+    window->scaledY = (factor < 1 ? 0 : (clientHeight - height) / 2);
+    
+    if (width == srcWidth && height == srcHeight) {
+        freeScaledImage(window);
+        return 0;
+    }
+    
+    if (!window->scaledImage || window->scaledImage->width != width
+        || window->scaledImage->height != height || window->scaledSmooth != smooth) {
+        freeScaledImage(window);
+        createScaledImage(window, width, height);
+        window->scaledSmooth = smooth;
+        if (smooth)
+            window->scaleScratch = (uint8*)malloc(width * srcHeight * (window->format.bitsPerPixel / 8));
+    }
+    
+    return 1;
+}
+
+static void clearBorders(PlatformWindow* window, int x, int y, int width, int height) {
+    int cw = window->presentWidth;
+    int ch = window->presentHeight;
+    
+    if (y > 0)               XClearArea(window->presentDisplay, window->window, 0, 0, cw, y, False);
+    if (y + height < ch)     XClearArea(window->presentDisplay, window->window, 0, y + height, cw, ch - y - height, False);
+    if (x > 0)               XClearArea(window->presentDisplay, window->window, 0, y, x, height, False);
+    if (x + width < cw)      XClearArea(window->presentDisplay, window->window, x + width, y, cw - x - width, height, False);
+}
+
+#ifdef HAVE_XPRESENT
+// Vsync-aligned presentation. Each frame is put in a pixmap, which is
+// presented at the first vblank after its handoff; completion events
+// tell when it was really shown, so that late frames can be counted.
+
+typedef struct {
+    int evtype;
+    uint32 serial;
+    Pixmap pixmap;
+    uint64_t ust, msc;
+    int mode;
+} PresentEventData;
+
+static Bool presentWireToCookie(Display* d, XGenericEventCookie* cookie, xEvent* wire) {
+    xGenericEvent* ge = (xGenericEvent*)wire;
+    PresentEventData* data = (PresentEventData*)calloc(1, sizeof(PresentEventData));
+    
+    cookie->type = ge->type & 0x7f;
+    cookie->serial = _XSetLastRequestRead(d, (xGenericReply*)wire);
+    cookie->send_event = ((ge->type & 0x80) != 0);
+    cookie->display = d;
+    cookie->extension = ge->extension;
+    cookie->evtype = ge->evtype;
+    cookie->data = data;
+    
+    if (!data) return False;
+    data->evtype = ge->evtype;
+    
+    if (ge->evtype == PresentCompleteNotify) {
+        xPresentCompleteNotify* e = (xPresentCompleteNotify*)wire;
+        data->serial = e->serial;
+        data->ust = e->ust;
+        data->msc = e->msc;
+        data->mode = e->mode;
+    }
+    else if (ge->evtype == PresentIdleNotify) {
+        xPresentIdleNotify* e = (xPresentIdleNotify*)wire;
+        data->serial = e->serial;
+        data->pixmap = e->pixmap;
+    }
+    return True;
+}
+
+// Returns 0 if the server can't do it
+static int presentInit(PlatformWindow* window) {
+    Display* dpy = window->presentDisplay;
+    int opcode, firstEvent, firstError, major, minor;
+    xPresentQueryVersionReq* req;
+    xPresentQueryVersionReply rep;
+    
+    if (!XQueryExtension(dpy, PRESENT_NAME, &opcode, &firstEvent, &firstError)
+        || !XGEQueryVersion(dpy, &major, &minor))
+        return 0;
+    
+    LockDisplay(dpy);
+    GetReq(PresentQueryVersion, req);
+    req->reqType = opcode;
+    req->presentReqType = X_PresentQueryVersion;
+    req->majorVersion = PRESENT_MAJOR;
+    req->minorVersion = PRESENT_MINOR;
+    Status ok = _XReply(dpy, (xReply*)&rep, 0, xTrue);
+    UnlockDisplay(dpy);
+    SyncHandle();
+    
+    if (!ok) return 0;
+    
+    XESetWireToEventCookie(dpy, opcode, presentWireToCookie);
+    
+    xPresentSelectInputReq* sel;
+    LockDisplay(dpy);
+    GetReq(PresentSelectInput, sel);
+    sel->reqType = opcode;
+    sel->presentReqType = X_PresentSelectInput;
+    sel->eid = XAllocID(dpy);
+    sel->window = window->window;
+    sel->eventMask = PresentCompleteNotifyMask | PresentIdleNotifyMask;
+    UnlockDisplay(dpy);
+    SyncHandle();
+    
+    return opcode;
+}
+
+static void presentFreePixmaps(PlatformWindow* window) {
+    for (int i = 0; i < PRESENT_NUM_PIXMAPS; i++) {
+        if (window->presentSlots[i].pixmap)
+            XFreePixmap(window->presentDisplay, window->presentSlots[i].pixmap);
+        window->presentSlots[i].pixmap = None;
+        window->presentSlots[i].busy = 0;
+    }
+    window->presentPixmapWidth = window->presentPixmapHeight = 0;
+}
+
+static void presentCompleted(PlatformWindow* window, PresentEventData* data) {
+    for (int i = 0; i < PRESENT_NUM_PIXMAPS; i++) {
+        PresentSlot* slot = &window->presentSlots[i];
+        
+        if (slot->serial != data->serial)
+            continue;
+        
+        window->numPresented++;
+        if (data->mode == PresentCompleteModeSkip
+            || (slot->targetMsc && data->msc > slot->targetMsc))
+            window->numMissed++;
+        break;
+    }
+    
+    if (window->lastMsc && data->msc > window->lastMsc && data->ust > window->lastUst)
+        window->mscInterval = (data->ust - window->lastUst) / (data->msc - window->lastMsc);
+    window->lastMsc = data->msc;
+    window->lastUst = data->ust;
+}
+
+// Events sent to the present connection
+static void handlePresentEvent(PlatformWindow* window, XEvent* xev) {
+    Display* d = window->presentDisplay;
+    
+#ifdef HAVE_XSHM
+    if (xev->type == XShmGetEventBase(d) + ShmCompletion) {
+        window->shmPending = 0;
+        return;
+    }
+#endif
+    if (xev->type == GenericEvent && xev->xcookie.extension == window->presentOpcode
+        && XGetEventData(d, &xev->xcookie)) {
+        PresentEventData* data = (PresentEventData*)xev->xcookie.data;
+        
+        if (data->evtype == PresentCompleteNotify)
+            presentCompleted(window, data);
+        else if (data->evtype == PresentIdleNotify) {
+            for (int i = 0; i < PRESENT_NUM_PIXMAPS; i++)
+                if (window->presentSlots[i].pixmap == data->pixmap)
+                    window->presentSlots[i].busy = 0;
+        }
+        XFreeEventData(d, &xev->xcookie);
+    }
+}
+
+// An idle pixmap of the given size, waiting for one if need be
+static PresentSlot* presentAcquireSlot(PlatformWindow* window, int width, int height) {
+    Display* d = window->presentDisplay;
+    XEvent xev;
+    
+    if (width != window->presentPixmapWidth || height != window->presentPixmapHeight) {
+        presentFreePixmaps(window);
+        for (int i = 0; i < PRESENT_NUM_PIXMAPS; i++)
+            window->presentSlots[i].pixmap = XCreatePixmap(d, window->window, width, height,
+                                                           window->depth);
+        window->presentPixmapWidth = width;
+        window->presentPixmapHeight = height;
+    }
+    
+    while (XPending(d)) {
+        XNextEvent(d, &xev);
+        handlePresentEvent(window, &xev);
+    }
+    
+    for (;;) {
+        for (int i = 0; i < PRESENT_NUM_PIXMAPS; i++)
+            if (!window->presentSlots[i].busy)
+                return &window->presentSlots[i];
+        
+        XNextEvent(d, &xev);
+        handlePresentEvent(window, &xev);
+    }
+}
+
+static void presentPixmap(PlatformWindow* window, PresentSlot* slot) {
+    Display* dpy = window->presentDisplay;
+    xPresentPixmapReq* req;
+    
+    // The first vblank from now, as far as we can tell. UST is taken to
+    // be CLOCK_MONOTONIC, as with the usual drivers; after a long pause,
+    // or if it looks otherwise, 0 still means the next vblank, but the
+    // frame can't be told late.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ust = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    
+    slot->targetMsc = 0;
+    if (window->mscInterval && ust >= window->lastUst && ust - window->lastUst < 1000000)
+        slot->targetMsc = window->lastMsc + 1 + (ust - window->lastUst) / window->mscInterval;
+    
+    slot->serial = ++window->presentSerial;
+    slot->busy = 1;
+    
+    LockDisplay(dpy);
+    GetReq(PresentPixmap, req);
+    req->reqType = window->presentOpcode;
+    req->presentReqType = X_PresentPixmap;
+    req->window = window->window;
+    req->pixmap = slot->pixmap;
+    req->serial = slot->serial;
+    req->valid = None;
+    req->update = None;
+    req->x_off = window->scaledX;
+    req->y_off = window->scaledY;
+    req->target_crtc = None;
+    req->wait_fence = None;
+    req->idle_fence = None;
+    req->options = PresentOptionNone;
+    req->pad1 = 0;
+    req->target_msc = slot->targetMsc;
+    req->divisor = 0;
+    req->remainder = 0;
+    UnlockDisplay(dpy);
+    SyncHandle();
+}
+#endif
+
+// Pushes a frame to the server, converted and scaled as needed
+static void presentFrame(PlatformWindow* window, PlatformSurface* frame) {
+    Display* d = window->presentDisplay;
+    XImage* image = window->ximage;
+#ifdef HAVE_XSHM
+    int useShm = 0;
+#endif
+    
+    if (window->convert)
+        window->convert(window, frame);
+    else
+        window->ximage->data = (char*)frame->pixels;
+    
+    if (updateScaledImage(window)) {
+        image = window->scaledImage;
+        
+#ifdef HAVE_XSHM
+        // The server may still be reading the previous frame
+        if (window->shmPending) {
+            XEvent xev;
+            XIfEvent(d, &xev, isShmCompletion, (XPointer)&window->shmInfo);
+            window->shmPending = 0;
+        }
+        useShm = window->useShm;
+#endif
+        
+        const uint8* src = (const uint8*)window->ximage->data;
+        int bytesPerPixel = window->format.bitsPerPixel / 8;
+        
+        if (window->scaledSmooth)
+            scaleBilinear(src, window->presentPitch, frame->width, frame->height,
+                          image, bytesPerPixel, window->scaleScratch);
+        else
+            scaleNearest(src, window->presentPitch, frame->width, frame->height,
+                         image, image->width / frame->width, bytesPerPixel);
+    }
+    
+    if (window->presentClearBorders) {
+        clearBorders(window, window->scaledX, window->scaledY, image->width, image->height);
+        window->presentClearBorders = 0;
+    }
+    
+    Drawable target = window->window;
+    int x = window->scaledX;
+    int y = window->scaledY;
+    
+#ifdef HAVE_XPRESENT
+    PresentSlot* slot = NULL;
+    
+    if (window->presentOpcode) {
+        slot = presentAcquireSlot(window, image->width, image->height);
+        target = slot->pixmap;
+        x = y = 0;
+    }
+#endif
+    
+#ifdef HAVE_XSHM
+    if (useShm) {
+        XShmPutImage(d, target, window->gc, image, 0, 0, x, y, image->width, image->height, True);
+        window->shmPending = 1;
+    }
+    else
+#endif
+    XPutImage(d, target, window->gc, image, 0, 0, x, y, image->width, image->height);
+    
+#ifdef HAVE_XPRESENT
+    if (slot)
+        presentPixmap(window, slot);
+#endif
+    
+    XFlush(d);
+}
+
+// Takes what the event loop learned about the window along with the frame.
+// Called with presentMutex held, when there is a present thread.
+static void takePresentState(PlatformWindow* window) {
+    window->presentWidth = window->clientWidth;
+    window->presentHeight = window->clientHeight;
+    window->presentClearBorders |= window->clearBorders;
+    window->clearBorders = 0;
+}
+
+static void* presentThreadFunc(void* arg) {
+    PlatformWindow* window = (PlatformWindow*)arg;
+    
+    pthread_mutex_lock(&window->presentMutex);
+    
+    for (;;) {
+        while (!window->presentRequested && !window->presentQuit)
+            pthread_cond_wait(&window->presentCond, &window->presentMutex);
+        
+        if (window->presentQuit)
+            break;
+        
+        window->presentRequested = 0;
+        window->presentBusy = 1;
+        takePresentState(window);
+        pthread_mutex_unlock(&window->presentMutex);
+        
+        presentFrame(window, window->frontSurface);
+        
+        pthread_mutex_lock(&window->presentMutex);
+        window->presentBusy = 0;
+        pthread_cond_broadcast(&window->presentCond);
+    }
+    
+    pthread_mutex_unlock(&window->presentMutex);
+    return NULL;
+}
+
+// Waits for the present thread to be done with the front buffer, and
+// returns with presentMutex held
+static void waitPresentIdle(PlatformWindow* window) {
+    pthread_mutex_lock(&window->presentMutex);
+    while (window->presentRequested || window->presentBusy)
+        pthread_cond_wait(&window->presentCond, &window->presentMutex);
+}
+
+static void startPresentThread(PlatformWindow* window) {
+    window->presentThreadRunning = 0;
+    window->presentRequested = window->presentBusy = window->presentQuit = 0;
+    
+    if (window->presentDisplay == display)
+        return;
+    
+    if (!window->primary)
+        window->frontSurface = platformCreateSurface(window->surface->width, window->surface->height);
+    pthread_mutex_init(&window->presentMutex, NULL);
+    pthread_cond_init(&window->presentCond, NULL);
+    
+    if (pthread_create(&window->presentThread, NULL, presentThreadFunc, window) == 0) {
+        window->presentThreadRunning = 1;
+        return;
+    }
+    
+    fprintf(stderr, "Warning: could not start the present thread\n");
+    pthread_mutex_destroy(&window->presentMutex);
+    pthread_cond_destroy(&window->presentCond);
+    if (!window->primary)
+        platformFreeSurface(window->frontSurface);
+    window->frontSurface = NULL;
+}
+
+static void stopPresentThread(PlatformWindow* window) {
+    if (!window->presentThreadRunning) return;
+    
+    pthread_mutex_lock(&window->presentMutex);
+    window->presentQuit = 1;
+    pthread_cond_broadcast(&window->presentCond);
+    pthread_mutex_unlock(&window->presentMutex);
+    
+    pthread_join(window->presentThread, NULL);
+    pthread_mutex_destroy(&window->presentMutex);
+    pthread_cond_destroy(&window->presentCond);
+    if (!window->primary)
+        platformFreeSurface(window->frontSurface);
+    window->frontSurface = NULL;
+    window->presentThreadRunning = 0;
+}
+
+// Waits for every output to be done with the front buffer, and returns
+// with all their presentMutex held
+static void waitOutputsIdle(PlatformWindow* window) {
+    for (PlatformWindow* out = window; out; out = out->nextOutput)
+        waitPresentIdle(out);
+}
 
-// Initialize platform
-int platformInit(void) {
-    display = XOpenDisplay(NULL);
-    if (!display) {
-        lastError = "Failed to open X display";
-        return -1;
+// Has every output push the primary's front buffer, and lets them go
+static void requestPresents(PlatformWindow* window) {
+    for (PlatformWindow* out = window; out; out = out->nextOutput) {
+        out->frontSurface = window->frontSurface;
+        out->presentRequested = 1;
+        pthread_cond_broadcast(&out->presentCond);
+        pthread_mutex_unlock(&out->presentMutex);
     }
-    
-    clock_gettime(CLOCK_MONOTONIC, &startTime);
+}
+
+static PlatformWindow* findOutput(Window w) {
+    for (PlatformWindow* out = mainWindow; out; out = out->nextOutput)
+        if (out->window == w)
+            return out;
+    return NULL;
+}
+
+// Window management
+
+static int adoptError;
+
+static int adoptErrorHandler(Display* d, XErrorEvent* e) {
+    adoptError = 1;
     return 0;
 }
 
-void platformShutdown(void) {
-    if (display) {
-        XCloseDisplay(display);
-        display = NULL;
+// Lists the monitors, one window each, with RandR when available, and
+// otherwise one per X screen. Cloned outputs show up once.
+static int listOutputs(OutputRect* outputs) {
+    int numOutputs = 0;
+    
+    for (int screen = 0; screen < ScreenCount(display) && numOutputs < MAX_OUTPUTS; screen++) {
+        int numFound = 0;
+        
+#ifdef HAVE_XRANDR
+        int eventBase, errorBase, major, minor;
+        
+        if (XRRQueryExtension(display, &eventBase, &errorBase)
+            && XRRQueryVersion(display, &major, &minor)
+            && (major > 1 || minor >= 3)) {
+            
+            XRRScreenResources* res = XRRGetScreenResourcesCurrent(display, RootWindow(display, screen));
+            
+            for (int i = 0; res && i < res->ncrtc && numOutputs < MAX_OUTPUTS; i++) {
+                XRRCrtcInfo* crtc = XRRGetCrtcInfo(display, res, res->crtcs[i]);
+                if (!crtc) continue;
+                
+                int isClone = 0;
+                for (int j = numOutputs - numFound; j < numOutputs; j++)
+                    if (outputs[j].x == crtc->x && outputs[j].y == crtc->y
+                        && outputs[j].width == (int)crtc->width && outputs[j].height == (int)crtc->height)
+                        isClone = 1;
+                
+                if (crtc->mode != None && crtc->noutput > 0 && !isClone) {
+                    OutputRect* o = &outputs[numOutputs++];
+                    o->screen = screen;
+                    o->x = crtc->x;
+                    o->y = crtc->y;
+                    o->width = crtc->width;
+                    o->height = crtc->height;
+                    numFound++;
+                }
+                XRRFreeCrtcInfo(crtc);
+            }
+            if (res) XRRFreeScreenResources(res);
+        }
+#endif
+        
+        if (!numFound) {
+            OutputRect* o = &outputs[numOutputs++];
+            o->screen = screen;
+            o->x = o->y = 0;
+            o->width = DisplayWidth(display, screen);
+            o->height = DisplayHeight(display, screen);
+        }
     }
+    
+    return numOutputs;
 }
 
-// Window management
-PlatformWindow* platformCreateWindow(const char* title, int width, int height, int fullscreen) {
-    if (!display) return NULL;
+// What's common to our own windows and adopted ones, once 'window' is set
+static PlatformWindow* setupWindow(PlatformWindow* window, PlatformWindow* primary,
+                                   int width, int height, int clientWidth, int clientHeight,
+                                   Visual* visual, int depth) {
+    window->primary = primary;
+    window->nextOutput = NULL;
+    
+    // Falls back to presenting from the engine thread on the main connection
+    window->presentDisplay = XOpenDisplay(DisplayString(display));
+    if (!window->presentDisplay)
+        window->presentDisplay = display;
+    
+    window->gc = XCreateGC(window->presentDisplay, window->window, 0, NULL);
+    
+    // The engine composites in the display's format when it is 565,
+    // which halves the bytes moved by every blit and by the present.
+    // Set once, before the first surface exists.
+    if (!primary && !mainWindow) {
+        PresentFormat f;
+        queryPresentFormat(&f, visual, depth);
+        surfacePixelSize = (isPresentFormat565(&f, visual) ? 2 : 4);
+    }
+    
+    window->surface = (primary ? primary->surface : platformCreateSurface(width, height));
+    window->isFullscreen = 0;
+    window->clientWidth = clientWidth;
+    window->clientHeight = clientHeight;
+    window->presentWidth = clientWidth;
+    window->presentHeight = clientHeight;
+    window->presentClearBorders = (clientWidth != width || clientHeight != height);
+    window->frontSurface = NULL;
+    window->scaledImage = NULL;
+    window->scaleScratch = NULL;
+    window->scaledSmooth = 0;
+    window->clearBorders = 0;
+    window->isObscured = 0;
+    window->dpmsOff = 0;
+    window->dpmsCheckTime = 0;
+#ifdef HAVE_XDPMS
+    int dpmsEventBase, dpmsErrorBase;
+    window->hasDpms = DPMSQueryExtension(display, &dpmsEventBase, &dpmsErrorBase)
+                      && DPMSCapable(display);
+#else
+    window->hasDpms = 0;
+#endif
+#ifdef HAVE_XSHM
+    memset(&window->shmInfo, 0, sizeof(window->shmInfo));
+    window->useShm = 0;
+    window->shmPending = 0;
+#endif
+    
+    platformCreatePresentImage(window, visual, depth);
+#ifdef HAVE_XPRESENT
+    // Only from the present thread, which has the connection to itself
+    memset(window->presentSlots, 0, sizeof(window->presentSlots));
+    window->presentPixmapWidth = window->presentPixmapHeight = 0;
+    window->presentSerial = 0;
+    window->lastMsc = window->lastUst = window->mscInterval = 0;
+    window->numPresented = window->numMissed = 0;
+    window->presentOpcode = (window->presentDisplay != display ? presentInit(window) : 0);
+#endif
+    startPresentThread(window);
     
+    if (!primary)
+        mainWindow = window;
+    
+    return window;
+}
+
+static PlatformWindow* createWindow(const char* title, PlatformWindow* primary,
+                                    OutputRect* output, int width, int height) {
     PlatformWindow* window = (PlatformWindow*)malloc(sizeof(PlatformWindow));
-    int screen = DefaultScreen(display);
+    int screen = (output ? output->screen : DefaultScreen(display));
+    int x = (output ? output->x : 0);
+    int y = (output ? output->y : 0);
     
     window->window = XCreateSimpleWindow(display, RootWindow(display, screen),
-                                        0, 0, width, height, 0,
+                                        x, y, width, height, 0,
                                         BlackPixel(display, screen),
                                         BlackPixel(display, screen));
+    window->isForeign = 0;
+    window->isMapped = 1;
     
     XSelectInput(display, window->window,
                 KeyPressMask | KeyReleaseMask | ExposureMask | 
-                StructureNotifyMask | FocusChangeMask);
+                StructureNotifyMask | FocusChangeMask | VisibilityChangeMask);
     
     XStoreName(display, window->window, title);
     
+    // Each on its own monitor, which is where it goes fullscreen
+    if (output) {
+        XSizeHints hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.flags = USPosition;
+        hints.x = x;
+        hints.y = y;
+        XSetWMNormalHints(display, window->window, &hints);
+    }
+    
     window->wmDeleteWindow = XInternAtom(display, "WM_DELETE_WINDOW", False);
     XSetWMProtocols(display, window->window, &window->wmDeleteWindow, 1);
     
     XMapWindow(display, window->window);
-    XFlush(display);
+    XSync(display, False);
     
-    window->gc = XCreateGC(display, window->window, 0, NULL);
+    return setupWindow(window, primary, width, height, width, height,
+                       DefaultVisual(display, screen), DefaultDepth(display, screen));
+}
+
+PlatformWindow* platformCreateWindow(const char* title, int width, int height, int fullscreen) {
+    if (!display) return NULL;
     
-    window->surface = platformCreateSurface(width, height);
-    window->isFullscreen = 0;
+    // Under xscreensaver, draw in the window it gives us
+    const char* screensaverWindow = getenv("XSCREENSAVER_WINDOW");
+    if (screensaverWindow && *screensaverWindow)
+        return platformAdoptWindow(screensaverWindow, width, height);
     
-    Visual* visual = DefaultVisual(display, screen);
-    int depth = DefaultDepth(display, screen);
+    if (!allOutputs) {
+        PlatformWindow* window = createWindow(title, NULL, NULL, width, height);
+        if (fullscreen)
+            platformToggleFullscreen(window);
+        return window;
+    }
     
-    window->ximage = XCreateImage(display, visual, depth, ZPixmap, 0,
-                                  (char*)window->surface->pixels,
-                                  width, height, 32, window->surface->pitch);
+    OutputRect outputs[MAX_OUTPUTS];
+    int numOutputs = listOutputs(outputs);
+    PlatformWindow* window = createWindow(title, NULL, &outputs[0], width, height);
+    PlatformWindow* last = window;
     
-    mainWindow = window;
+    for (int i = 1; i < numOutputs; i++) {
+        PlatformWindow* out = createWindow(title, window, &outputs[i], width, height);
+        
+        // Only the primary may be presented from the engine thread
+        if (window->presentThreadRunning && !out->presentThreadRunning) {
+            fprintf(stderr, "Warning: could not use output %d\n", i);
+            platformDestroyWindow(out);
+            continue;
+        }
+        
+        last->nextOutput = out;
+        last = out;
+    }
     
-    if (fullscreen) {
+    if (fullscreen)
         platformToggleFullscreen(window);
-    }
     
     return window;
 }
 
+// Draws in a window someone else created: it isn't mapped, named or
+// made fullscreen by us, and the frame is scaled to whatever size it has
+PlatformWindow* platformAdoptWindow(const char* windowId, int width, int height) {
+    if (!display) return NULL;
+    
+    char* end;
+    Window id = (Window)strtoul(windowId, &end, 0);
+    if (end == windowId || *end) {
+        lastError = "Invalid window id";
+        return NULL;
+    }
+    
+    XWindowAttributes attr;
+    int (*oldHandler)(Display*, XErrorEvent*) = XSetErrorHandler(adoptErrorHandler);
+    adoptError = 0;
+    Status ok = XGetWindowAttributes(display, id, &attr);
+    if (ok && !adoptError) {
+        XSelectInput(display, id,
+                    KeyPressMask | KeyReleaseMask | ExposureMask | 
+                    StructureNotifyMask | FocusChangeMask | VisibilityChangeMask);
+        XSync(display, False);
+    }
+    XSetErrorHandler(oldHandler);
+    
+    if (!ok || adoptError) {
+        lastError = "No such window";
+        return NULL;
+    }
+    
+    PlatformWindow* window = (PlatformWindow*)malloc(sizeof(PlatformWindow));
+    window->window = id;
+    window->isForeign = 1;
+    window->isMapped = (attr.map_state == IsViewable);
+    window->wmDeleteWindow = None;
+    
+    return setupWindow(window, NULL, width, height, attr.width, attr.height,
+                       attr.visual, attr.depth);
+}
+
 void platformDestroyWindow(PlatformWindow* window) {
     if (window) {
+        // The other outputs first, as they use our buffers
+        platformDestroyWindow(window->nextOutput);
+        stopPresentThread(window);
+        if (!window->primary)
+            stopScaleWorkers();
         if (window->ximage) {
             window->ximage->data = NULL;  // Prevent XDestroyImage from freeing our pixels
             XDestroyImage(window->ximage);
         }
+        free(window->presentPixels);
+        freeScaledImage(window);
+#ifdef HAVE_XPRESENT
+        if (window->presentOpcode) {
+            presentFreePixmaps(window);
+            if (window->numMissed)
+                fprintf(stderr, "Warning: %d of %d frames missed their vblank\n",
+                        window->numMissed, window->numPresented);
+        }
+#endif
         if (window->gc) {
-            XFreeGC(display, window->gc);
+            XFreeGC(window->presentDisplay, window->gc);
         }
-        if (window->surface) {
+        if (window->presentDisplay != display) {
+            XCloseDisplay(window->presentDisplay);
+        }
+        if (window->surface && !window->primary) {
             platformFreeSurface(window->surface);
         }
-        XDestroyWindow(display, window->window);
+        if (!window->isForeign) {
+            XDestroyWindow(display, window->window);
+        }
         free(window);
     }
 }
@@ -139,41 +1523,141 @@ void platformShowCursor(int show) {
         bitmapNoData = XCreateBitmapFromData(display, mainWindow->window, noData, 8, 8);
         invisibleCursor = XCreatePixmapCursor(display, bitmapNoData, bitmapNoData,
                                              &black, &black, 0, 0);
-        XDefineCursor(display, mainWindow->window, invisibleCursor);
+        for (PlatformWindow* out = mainWindow; out; out = out->nextOutput)
+            XDefineCursor(display, out->window, invisibleCursor);
         XFreeCursor(display, invisibleCursor);
         XFreePixmap(display, bitmapNoData);
     } else {
-        XUndefineCursor(display, mainWindow->window);
+        for (PlatformWindow* out = mainWindow; out; out = out->nextOutput)
+            XUndefineCursor(display, out->window);
     }
 }
 
 void platformToggleFullscreen(PlatformWindow* window) {
+    if (window->isForeign) return;
+    
     Atom wmState = XInternAtom(display, "_NET_WM_STATE", False);
     Atom fullscreen = XInternAtom(display, "_NET_WM_STATE_FULLSCREEN", False);
     
-    XEvent xev;
-    memset(&xev, 0, sizeof(xev));
-    xev.type = ClientMessage;
-    xev.xclient.window = window->window;
-    xev.xclient.message_type = wmState;
-    xev.xclient.format = 32;
-    xev.xclient.data.l[0] = window->isFullscreen ? 0 : 1;
-    xev.xclient.data.l[1] = fullscreen;
-    xev.xclient.data.l[2] = 0;
-    
-    XSendEvent(display, DefaultRootWindow(display), False,
-              SubstructureRedirectMask | SubstructureNotifyMask, &xev);
-    
-    window->isFullscreen = !window->isFullscreen;
+    for (PlatformWindow* out = window; out; out = out->nextOutput) {
+        XWindowAttributes attr;
+        XGetWindowAttributes(display, out->window, &attr);
+        
+        XEvent xev;
+        memset(&xev, 0, sizeof(xev));
+        xev.type = ClientMessage;
+        xev.xclient.window = out->window;
+        xev.xclient.message_type = wmState;
+        xev.xclient.format = 32;
+        xev.xclient.data.l[0] = out->isFullscreen ? 0 : 1;
+        xev.xclient.data.l[1] = fullscreen;
+        xev.xclient.data.l[2] = 0;
+        
+        XSendEvent(display, attr.root, False,
+                  SubstructureRedirectMask | SubstructureNotifyMask, &xev);
+        
+        out->isFullscreen = !out->isFullscreen;
+    }
     XFlush(display);
 }
 
+void platformSetScaleFilter(int smooth) {
+    scaleSmooth = smooth;
+}
+
+void platformSetAllOutputs(int all) {
+    allOutputs = all;
+}
+
+// Shows the window surface, which keeps its contents. With the present
+// thread, that's a copy to the front buffer; only used for effects
+// drawn straight on the window.
 void platformUpdateWindow(PlatformWindow* window) {
     if (!window || !window->ximage) return;
     
-    XPutImage(display, window->window, window->gc, window->ximage,
-             0, 0, 0, 0, window->surface->width, window->surface->height);
-    XFlush(display);
+    if (!window->presentThreadRunning) {
+        for (PlatformWindow* out = window; out; out = out->nextOutput) {
+            takePresentState(out);
+            presentFrame(out, window->surface);
+        }
+        return;
+    }
+    
+    waitOutputsIdle(window);
+    memcpy(window->frontSurface->pixels, window->surface->pixels,
+           window->surface->pitch * window->surface->height);
+    requestPresents(window);
+}
+
+// Shows the last frame handed over again, e.g. once the window was
+// exposed. The window surface is not: it may hold an older frame, or
+// one still being drawn.
+void platformRefreshWindow(PlatformWindow* window) {
+    if (!window || !window->ximage) return;
+    
+    if (!window->presentThreadRunning) {
+        platformUpdateWindow(window);
+        return;
+    }
+    
+    waitOutputsIdle(window);
+    requestPresents(window);
+}
+
+// Hands the frame over to the present thread and returns at once: the
+// buffers are swapped, and the window surface now holds an older frame.
+// Waits only if the previous frame is still being pushed.
+void platformPresentWindow(PlatformWindow* window) {
+    if (!window || !window->ximage) return;
+    
+    if (!window->presentThreadRunning) {
+        platformUpdateWindow(window);
+        return;
+    }
+    
+    waitOutputsIdle(window);
+    PlatformSurface* frame = window->surface;
+    window->surface = window->frontSurface;
+    window->frontSurface = frame;
+    requestPresents(window);
+}
+
+// Brings the window surface back to the last frame handed over
+void platformSyncWindowSurface(PlatformWindow* window) {
+    if (!window || !window->presentThreadRunning) return;
+    
+    waitPresentIdle(window);
+    memcpy(window->surface->pixels, window->frontSurface->pixels,
+           window->surface->pitch * window->surface->height);
+    pthread_mutex_unlock(&window->presentMutex);
+}
+
+int platformIsWindowVisible(PlatformWindow* window) {
+    if (!window) return 0;
+    
+#ifdef HAVE_XDPMS
+    if (window->hasDpms) {
+        uint32 now = platformGetTicks();
+        
+        if (now - window->dpmsCheckTime >= DPMS_CHECK_INTERVAL) {
+            CARD16 level;
+            BOOL enabled;
+            
+            window->dpmsCheckTime = now;
+            window->dpmsOff = DPMSInfo(display, &level, &enabled)
+                              && enabled && level != DPMSModeOn;
+        }
+    }
+#endif
+    
+    if (window->dpmsOff)
+        return 0;
+    
+    for (PlatformWindow* out = window; out; out = out->nextOutput)
+        if (out->isMapped && !out->isObscured)
+            return 1;
+    
+    return 0;
 }
 
 PlatformSurface* platformGetWindowSurface(PlatformWindow* window) {
@@ -185,9 +1669,9 @@ PlatformSurface* platformCreateSurface(int width, int height) {
     PlatformSurface* surface = (PlatformSurface*)malloc(sizeof(PlatformSurface));
     surface->width = width;
     surface->height = height;
-    surface->bytesPerPixel = 4;
-    surface->pitch = width * 4;
-    surface->pixels = (uint8*)calloc(width * height, 4);
+    surface->bytesPerPixel = surfacePixelSize;
+    surface->pitch = width * surfacePixelSize;
+    surface->pixels = (uint8*)calloc(width * height, surfacePixelSize);
     surface->hasColorKey = 0;
     surface->clipRect.x = 0;
     surface->clipRect.y = 0;
@@ -201,7 +1685,7 @@ PlatformSurface* platformCreateSurfaceFrom(void* pixels, int width, int height,
     PlatformSurface* surface = (PlatformSurface*)malloc(sizeof(PlatformSurface));
     surface->width = width;
     surface->height = height;
-    surface->bytesPerPixel = 4;
+    surface->bytesPerPixel = surfacePixelSize;
     surface->pitch = pitch;
     surface->pixels = (uint8*)pixels;
     surface->hasColorKey = 0;
@@ -263,6 +1747,33 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
     
     if (srcW <= 0 || srcH <= 0) return;
     
+    // Opaque source: whole rows can be copied, once clipped to both surfaces
+    if (!src->hasColorKey) {
+        int skipX = 0, skipY = 0;
+        if (srcX < 0) skipX = -srcX;
+        if (dstX + skipX < 0) skipX = -dstX;
+        if (srcY < 0) skipY = -srcY;
+        if (dstY + skipY < 0) skipY = -dstY;
+        
+        int w = srcW;
+        int h = srcH;
+        if (srcX + w > src->width) w = src->width - srcX;
+        if (dstX + w > dst->width) w = dst->width - dstX;
+        if (srcY + h > src->height) h = src->height - srcY;
+        if (dstY + h > dst->height) h = dst->height - dstY;
+        
+        w -= skipX;
+        h -= skipY;
+        if (w <= 0 || h <= 0) return;
+        
+        for (int y = skipY; y < skipY + h; y++) {
+            memcpy(dst->pixels + (dstY + y) * dst->pitch + (dstX + skipX) * dst->bytesPerPixel,
+                   src->pixels + (srcY + y) * src->pitch + (srcX + skipX) * src->bytesPerPixel,
+                   (size_t)w * dst->bytesPerPixel);
+        }
+        return;
+    }
+    
     for (int y = 0; y < srcH; y++) {
         for (int x = 0; x < srcW; x++) {
             int sx = srcX + x;
@@ -277,12 +1788,17 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
             uint8* dstPixel = dst->pixels + dy * dst->pitch + dx * dst->bytesPerPixel;
             
             // Check color key
-            if (src->hasColorKey) {
-                if (srcPixel[0] == src->colorKeyB &&
-                    srcPixel[1] == src->colorKeyG &&
-                    srcPixel[2] == src->colorKeyR) {
+            if (src->bytesPerPixel == 2) {
+                if (*(uint16*)srcPixel == src->colorKeyPixel)
                     continue;
-                }
+                *(uint16*)dstPixel = *(uint16*)srcPixel;
+                continue;
+            }
+            
+            if (srcPixel[0] == src->colorKeyB &&
+                srcPixel[1] == src->colorKeyG &&
+                srcPixel[2] == src->colorKeyR) {
+                continue;
             }
             
             memcpy(dstPixel, srcPixel, 4);
@@ -299,15 +1815,43 @@ void platformFillRect(PlatformSurface* surface, PlatformRect* rect,
     int w = rect ? rect->w : surface->width;
     int h = rect ? rect->h : surface->height;
     
-    for (int py = y; py < y + h && py < surface->height; py++) {
-        for (int px = x; px < x + w && px < surface->width; px++) {
-            uint8* pixel = surface->pixels + py * surface->pitch + px * surface->bytesPerPixel;
-            pixel[0] = b;
-            pixel[1] = g;
-            pixel[2] = r;
-            pixel[3] = a;
+    // Clip to the surface clip rect
+    int x2 = x + w;
+    int y2 = y + h;
+    if (x < surface->clipRect.x) x = surface->clipRect.x;
+    if (y < surface->clipRect.y) y = surface->clipRect.y;
+    if (x2 > surface->clipRect.x + surface->clipRect.w) x2 = surface->clipRect.x + surface->clipRect.w;
+    if (y2 > surface->clipRect.y + surface->clipRect.h) y2 = surface->clipRect.y + surface->clipRect.h;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x2 > surface->width) x2 = surface->width;
+    if (y2 > surface->height) y2 = surface->height;
+    
+    if (x2 <= x || y2 <= y) return;
+    
+    // Fill the first row, then replicate it
+    uint8* firstRow = surface->pixels + y * surface->pitch + x * surface->bytesPerPixel;
+    
+    if (surface->bytesPerPixel == 2) {
+        uint16 color = (uint16)platformMapRGB(surface, r, g, b);
+        uint16* dst = (uint16*)firstRow;
+        for (int px = x; px < x2; px++) {
+            *dst++ = color;
+        }
+    } else {
+        uint8 bgra[4] = { b, g, r, a };
+        uint32 color;
+        memcpy(&color, bgra, 4);
+        uint32* dst = (uint32*)firstRow;
+        for (int px = x; px < x2; px++) {
+            *dst++ = color;
         }
     }
+    
+    size_t rowBytes = (size_t)(x2 - x) * surface->bytesPerPixel;
+    for (int py = y + 1; py < y2; py++) {
+        memcpy(firstRow + (py - y) * surface->pitch, firstRow, rowBytes);
+    }
 }
 
 void platformSetColorKey(PlatformSurface* surface, uint8 r, uint8 g, uint8 b) {
@@ -316,9 +1860,19 @@ void platformSetColorKey(PlatformSurface* surface, uint8 r, uint8 g, uint8 b) {
         surface->colorKeyR = r;
         surface->colorKeyG = g;
         surface->colorKeyB = b;
+        surface->colorKeyPixel = (uint16)platformMapRGB(surface, r, g, b);
     }
 }
 
+int platformGetColorKey(PlatformSurface* surface, uint8* r, uint8* g, uint8* b) {
+    if (!surface || !surface->hasColorKey) return 0;
+    
+    *r = surface->colorKeyR;
+    *g = surface->colorKeyG;
+    *b = surface->colorKeyB;
+    return 1;
+}
+
 void platformSetClipRect(PlatformSurface* surface, PlatformRect* rect) {
     if (surface) {
         if (rect) {
@@ -339,6 +1893,8 @@ void platformGetClipRect(PlatformSurface* surface, PlatformRect* rect) {
 }
 
 uint32 platformMapRGB(PlatformSurface* surface, uint8 r, uint8 g, uint8 b) {
+    if (surface && surface->bytesPerPixel == 2)
+        return ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
     return (r << 16) | (g << 8) | b;
 }
 
@@ -363,6 +1919,10 @@ int platformGetSurfaceBytesPerPixel(PlatformSurface* surface) {
     return surface ? surface->bytesPerPixel : 0;
 }
 
+int platformGetPixelSize(void) {
+    return surfacePixelSize;
+}
+
 // Events
 int platformPollEvent(PlatformEvent* event) {
     if (!display) return 0;
@@ -402,12 +1962,65 @@ int platformPollEvent(PlatformEvent* event) {
             event->type = EVENT_WINDOW_REFRESH;
             return 1;
         
+        case ConfigureNotify: {
+            PlatformWindow* out = findOutput(xev.xconfigure.window);
+            if (out && (xev.xconfigure.width != out->clientWidth
+                        || xev.xconfigure.height != out->clientHeight)) {
+                if (out->presentThreadRunning)
+                    pthread_mutex_lock(&out->presentMutex);
+                out->clientWidth = xev.xconfigure.width;
+                out->clientHeight = xev.xconfigure.height;
+                out->clearBorders = 1;
+                if (out->presentThreadRunning)
+                    pthread_mutex_unlock(&out->presentMutex);
+                event->type = EVENT_WINDOW_REFRESH;
+                return 1;
+            }
+            break;
+        }
+        
+        case MapNotify:
+        case UnmapNotify: {
+            PlatformWindow* out = findOutput(xev.xany.window);
+            if (out)
+                out->isMapped = (xev.type == MapNotify);
+            break;
+        }
+        
+        case DestroyNotify:
+            // Only an adopted window can go away under our feet
+            if (mainWindow && mainWindow->isForeign
+                && xev.xdestroywindow.window == mainWindow->window) {
+                event->type = EVENT_QUIT;
+                return 1;
+            }
+            break;
+        
+        case VisibilityNotify: {
+            PlatformWindow* out = findOutput(xev.xvisibility.window);
+            if (out)
+                out->isObscured = (xev.xvisibility.state == VisibilityFullyObscured);
+            break;
+        }
+        
         case ClientMessage:
-            if (mainWindow && (Atom)xev.xclient.data.l[0] == mainWindow->wmDeleteWindow) {
+            if (mainWindow && mainWindow->wmDeleteWindow != None
+                && (Atom)xev.xclient.data.l[0] == mainWindow->wmDeleteWindow) {
                 event->type = EVENT_QUIT;
                 return 1;
             }
             break;
+        
+        default:
+#ifdef HAVE_XSHM
+            if (mainWindow && mainWindow->presentDisplay == display
+                && xev.type == XShmGetEventBase(display) + ShmCompletion) {
+                for (PlatformWindow* out = mainWindow; out; out = out->nextOutput)
+                    if (isShmCompletion(display, &xev, (XPointer)&out->shmInfo))
+                        out->shmPending = 0;
+            }
+#endif
+            break;
     }
     
     return 0;
@@ -423,27 +2036,226 @@ uint32 platformGetTicks(void) {
     return (uint32)(elapsed_ns / 1000000);
 }
 
+uint64 platformGetMicros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    return (uint64)(now.tv_sec - startTime.tv_sec) * 1000000 +
+           (now.tv_nsec - startTime.tv_nsec) / 1000;
+}
+
 void platformDelay(uint32 ms) {
     usleep(ms * 1000);
 }
 
+// Sleeps in poll() on the X connection and on a timer armed with the
+// deadline, so that we wake up once, either for input or right on time
+void platformWaitEvent(uint64 deadline) {
+    struct pollfd fds[2];
+    int numFds = 0;
+    int timeout = -1;
+    
+    if (display) {
+        // Xlib may already have read some events off the socket
+        if (XEventsQueued(display, QueuedAfterFlush))
+            return;
+        fds[numFds].fd = ConnectionNumber(display);
+        fds[numFds].events = POLLIN;
+        numFds++;
+    }
+    
+    if (deadline != PLATFORM_NO_DEADLINE) {
+        uint64 now = platformGetMicros();
+        
+        if (now >= deadline)
+            return;
+        
+        if (timerFd >= 0) {
+            struct itimerspec when;
+            memset(&when, 0, sizeof(when));
+            when.it_value.tv_sec = startTime.tv_sec + deadline / 1000000;
+            when.it_value.tv_nsec = startTime.tv_nsec + (long)(deadline % 1000000) * 1000;
+            if (when.it_value.tv_nsec >= 1000000000) {
+                when.it_value.tv_sec++;
+                when.it_value.tv_nsec -= 1000000000;
+            }
+            timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &when, NULL);
+            fds[numFds].fd = timerFd;
+            fds[numFds].events = POLLIN;
+            numFds++;
+        } else {
+            timeout = (int)((deadline - now + 999) / 1000);
+        }
+    }
+    
+    if (!numFds && timeout < 0)
+        return;
+    
+    while (poll(fds, numFds, timeout) < 0 && errno == EINTR)
+        ;
+    
+    // Drop the expiration, if that's what woke us up. Rearming the
+    // timer next time resets it anyway.
+    for (int i = 0; i < numFds; i++) {
+        if (fds[i].fd == timerFd && (fds[i].revents & POLLIN)) {
+            uint64_t expirations;
+            if (read(timerFd, &expirations, sizeof(expirations)) < 0)
+                break;
+        }
+    }
+}
+
 // Audio
+//
+// The device is opened with the period and buffer sizes asked for, so
+// that what is mixed now is heard a known, short time later. Buffers are
+// mixed straight into the device's memory when it can be mapped, and
+// written to it otherwise. Underruns are recovered from and counted.
+//
+// After AUDIO_IDLE_TIME of silence, the stream is stopped and the audio
+// thread sleeps, until platformWakeAudio() tells there's a sound to play.
 static snd_pcm_t* pcmHandle = NULL;
 static PlatformAudioCallback audioCallback = NULL;
 static void* audioUserData = NULL;
 static uint8* audioBuffer = NULL;
 static int audioBufferSize = 0;
+static snd_pcm_uframes_t audioPeriodSize = 0;
+static int audioChannels = 1;
+static int audioFrameSize = 1;          // Bytes
+static int audioRate = 0;
+static int audioUseMmap = 0;
 static pthread_t audioThread;
 static int audioThreadRunning = 0;
+static PlatformAudioStats audioStats;
+static uint64 audioTotalDelay = 0;
+static uint32 audioNumDelays = 0;
+static uint32 audioSilentFrames = 0;
+static pthread_mutex_t audioMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t audioWakeCond = PTHREAD_COND_INITIALIZER;
+static int audioWakeRequested = 0;
+
+#define AUDIO_IDLE_TIME 500   // ms
+
+static int audioRecover(int err) {
+    if (err == -EPIPE)
+        audioStats.numXruns++;
+    
+    err = snd_pcm_recover(pcmHandle, err, 1);
+    if (err < 0)
+        fprintf(stderr, "Warning: ALSA could not recover: %s\n", snd_strerror(err));
+    return err;
+}
+
+// How long from now until what's written next is heard
+static void audioMeasureDelay(void) {
+    snd_pcm_sframes_t delay;
+    
+    if (snd_pcm_delay(pcmHandle, &delay) < 0 || delay < 0)
+        return;
+    
+    uint32 us = (uint32)((uint64)delay * 1000000 / audioRate);
+    audioTotalDelay += us;
+    audioNumDelays++;
+    if (us > audioStats.maxLatency)
+        audioStats.maxLatency = us;
+}
+
+static void audioMix(uint8* dst, snd_pcm_uframes_t frames) {
+    if (audioCallback(audioUserData, dst, frames * audioFrameSize))
+        audioSilentFrames = 0;
+    else
+        audioSilentFrames += frames;
+}
+
+// Once silent for long enough, stops the stream and sleeps until woken
+// up. The buffer only holds silence by then, and can be dropped. The
+// lock only covers the flag and the wait, never the device calls: the
+// engine takes it in platformWakeAudio() whenever a sound is played.
+static void audioSuspendIfIdle(void) {
+    if (audioSilentFrames < (uint32)audioRate * AUDIO_IDLE_TIME / 1000)
+        return;
+
+    audioSilentFrames = 0;
+
+    pthread_mutex_lock(&audioMutex);
+    int isIdle = (!audioWakeRequested && audioThreadRunning);
+    pthread_mutex_unlock(&audioMutex);
+
+    if (isIdle) {
+        snd_pcm_drop(pcmHandle);
+        audioStats.numSuspends++;
+    }
+
+    pthread_mutex_lock(&audioMutex);
+    while (isIdle && !audioWakeRequested && audioThreadRunning)
+        pthread_cond_wait(&audioWakeCond, &audioMutex);
+    audioWakeRequested = 0;
+    pthread_mutex_unlock(&audioMutex);
+
+    if (isIdle)
+        snd_pcm_prepare(pcmHandle);
+}
+
+static int audioWritePeriodMmap(void) {
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t offset, frames = audioPeriodSize;
+    
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(pcmHandle);
+    if (avail < 0)
+        return audioRecover((int)avail);
+    
+    if ((snd_pcm_uframes_t)avail < audioPeriodSize) {
+        // Not started yet, with the buffer full: start it
+        if (snd_pcm_state(pcmHandle) == SND_PCM_STATE_PREPARED)
+            return snd_pcm_start(pcmHandle);
+        
+        int err = snd_pcm_wait(pcmHandle, 1000);
+        return (err < 0 ? audioRecover(err) : 0);
+    }
+    
+    int err = snd_pcm_mmap_begin(pcmHandle, &areas, &offset, &frames);
+    if (err < 0)
+        return audioRecover(err);
+    
+    uint8* dst = (uint8*)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+    audioMix(dst, frames);
+    
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcmHandle, offset, frames);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != frames)
+        return audioRecover(committed < 0 ? (int)committed : -EPIPE);
+    
+    return 0;
+}
+
+static int audioWritePeriod(void) {
+    audioMix(audioBuffer, audioPeriodSize);
+    
+    uint8* ptr = audioBuffer;
+    snd_pcm_uframes_t remaining = audioPeriodSize;
+    
+    while (remaining > 0) {
+        snd_pcm_sframes_t written = snd_pcm_writei(pcmHandle, ptr, remaining);
+        if (written < 0) {
+            if (audioRecover((int)written) < 0)
+                return -1;
+            continue;
+        }
+        ptr += written * audioFrameSize;
+        remaining -= written;
+    }
+    
+    return 0;
+}
 
 static void* audioThreadFunc(void* arg) {
     while (audioThreadRunning) {
-        if (audioCallback) {
-            audioCallback(audioUserData, audioBuffer, audioBufferSize);
-            snd_pcm_writei(pcmHandle, audioBuffer, audioBufferSize);
-        } else {
+        int err = (audioUseMmap ? audioWritePeriodMmap() : audioWritePeriod());
+        if (err < 0) {
             usleep(10000);
+            continue;
         }
+        audioMeasureDelay();
+        audioSuspendIfIdle();
     }
     return NULL;
 }
@@ -454,12 +2266,15 @@ int platformInitAudio(void) {
 
 void platformCloseAudio(void) {
     if (audioThreadRunning) {
+        pthread_mutex_lock(&audioMutex);
         audioThreadRunning = 0;
+        pthread_cond_signal(&audioWakeCond);
+        pthread_mutex_unlock(&audioMutex);
         pthread_join(audioThread, NULL);
     }
     
     if (pcmHandle) {
-        snd_pcm_drain(pcmHandle);
+        snd_pcm_drop(pcmHandle);
         snd_pcm_close(pcmHandle);
         pcmHandle = NULL;
     }
@@ -470,6 +2285,49 @@ void platformCloseAudio(void) {
     }
 }
 
+static int audioSetHwParams(PlatformAudioSpec* spec, snd_pcm_access_t access) {
+    snd_pcm_hw_params_t* params;
+    snd_pcm_uframes_t periodSize = spec->samples;
+    unsigned int periods = (spec->periods ? spec->periods : 2);
+    unsigned int rate = spec->freq;
+    unsigned int channels = spec->channels;
+    snd_pcm_format_t format = (spec->format == 16 ? SND_PCM_FORMAT_S16 : SND_PCM_FORMAT_U8);
+    
+    snd_pcm_hw_params_alloca(&params);
+    snd_pcm_hw_params_any(pcmHandle, params);
+    
+    if (snd_pcm_hw_params_set_access(pcmHandle, params, access) < 0)
+        return -1;
+    
+    // A rate and channels the device really has, rather than have the
+    // plug layer convert in real time: the caller converts its sounds
+    if (snd_pcm_hw_params_set_format(pcmHandle, params, format) < 0)
+        return -1;
+    snd_pcm_hw_params_set_rate_resample(pcmHandle, params, 0);
+    snd_pcm_hw_params_set_channels_near(pcmHandle, params, &channels);
+    snd_pcm_hw_params_set_rate_near(pcmHandle, params, &rate, 0);
+    snd_pcm_hw_params_set_period_size_near(pcmHandle, params, &periodSize, 0);
+    snd_pcm_hw_params_set_periods_near(pcmHandle, params, &periods, 0);
+    
+    if (snd_pcm_hw_params(pcmHandle, params) < 0)
+        return -1;
+    
+    snd_pcm_uframes_t bufferSize;
+    snd_pcm_hw_params_get_period_size(params, &periodSize, 0);
+    snd_pcm_hw_params_get_buffer_size(params, &bufferSize);
+    
+    spec->freq = rate;
+    spec->channels = channels;
+    spec->samples = periodSize;
+    audioPeriodSize = periodSize;
+    audioRate = rate;
+    audioStats.periodSize = periodSize;
+    audioStats.bufferSize = bufferSize;
+    audioStats.bufferLatency = (uint32)((uint64)bufferSize * 1000000 / rate);
+    
+    return 0;
+}
+
 int platformOpenAudio(PlatformAudioSpec* spec) {
     int err;
     
@@ -479,24 +2337,33 @@ int platformOpenAudio(PlatformAudioSpec* spec) {
         return -1;
     }
     
-    snd_pcm_hw_params_t* params;
-    snd_pcm_hw_params_alloca(&params);
-    snd_pcm_hw_params_any(pcmHandle, params);
-    snd_pcm_hw_params_set_access(pcmHandle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(pcmHandle, params, SND_PCM_FORMAT_U8);
-    snd_pcm_hw_params_set_channels(pcmHandle, params, spec->channels);
-    snd_pcm_hw_params_set_rate_near(pcmHandle, params, (unsigned int*)&spec->freq, 0);
+    memset(&audioStats, 0, sizeof(audioStats));
+    audioTotalDelay = 0;
+    audioNumDelays = 0;
+    audioSilentFrames = 0;
+    audioWakeRequested = 0;
     
-    err = snd_pcm_hw_params(pcmHandle, params);
-    if (err < 0) {
+    audioUseMmap = (audioSetHwParams(spec, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0);
+    if (!audioUseMmap && audioSetHwParams(spec, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
         lastError = "Failed to set ALSA parameters";
         snd_pcm_close(pcmHandle);
+        pcmHandle = NULL;
         return -1;
     }
     
+    // Start as soon as a period is there, and wake up for each period
+    snd_pcm_sw_params_t* swParams;
+    snd_pcm_sw_params_alloca(&swParams);
+    snd_pcm_sw_params_current(pcmHandle, swParams);
+    snd_pcm_sw_params_set_start_threshold(pcmHandle, swParams, audioPeriodSize);
+    snd_pcm_sw_params_set_avail_min(pcmHandle, swParams, audioPeriodSize);
+    snd_pcm_sw_params(pcmHandle, swParams);
+    
     audioCallback = spec->callback;
     audioUserData = spec->userdata;
-    audioBufferSize = spec->samples * spec->channels;
+    audioChannels = spec->channels;
+    audioFrameSize = spec->channels * (spec->format == 16 ? 2 : 1);
+    audioBufferSize = audioPeriodSize * audioFrameSize;
     audioBuffer = (uint8*)malloc(audioBufferSize);
     
     audioThreadRunning = 1;
@@ -505,6 +2372,15 @@ int platformOpenAudio(PlatformAudioSpec* spec) {
     return 0;
 }
 
+// Also once the device is closed, for the final figures
+int platformGetAudioStats(PlatformAudioStats* stats) {
+    if (!audioRate) return -1;
+    
+    *stats = audioStats;
+    stats->latency = (audioNumDelays ? (uint32)(audioTotalDelay / audioNumDelays) : 0);
+    return 0;
+}
+
 void platformPauseAudio(int pause) {
     if (pcmHandle) {
         if (pause) {
@@ -515,6 +2391,14 @@ void platformPauseAudio(int pause) {
     }
 }
 
+// The lock is only ever held briefly by the audio thread, going to sleep
+void platformWakeAudio(void) {
+    pthread_mutex_lock(&audioMutex);
+    audioWakeRequested = 1;
+    pthread_cond_signal(&audioWakeCond);
+    pthread_mutex_unlock(&audioMutex);
+}
+
 void platformLockAudio(void) {
     // Not implemented for ALSA
 }
@@ -562,6 +2446,32 @@ void platformFreeWAV(uint8* audio_buf) {
     free(audio_buf);
 }
 
+uint8* platformMapFile(const char* filename, uint32* size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        lastError = "Failed to open file";
+        return NULL;
+    }
+    
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    
+    if (data == MAP_FAILED) {
+        lastError = "Failed to map file";
+        return NULL;
+    }
+    
+    *size = (uint32)st.st_size;
+    return (uint8*)data;
+}
+
+void platformUnmapFile(uint8* data, uint32 size) {
+    munmap(data, size);
+}
+
 const char* platformGetError(void) {
     return lastError;
 }
@@ -9,6 +9,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <mach/mach_time.h>
 #include <AudioToolbox/AudioToolbox.h>
 #include <Cocoa/Cocoa.h>
@@ -148,6 +152,11 @@ PlatformWindow* platformCreateWindow(const char* title, int width, int height, i
     }
 }
 
+PlatformWindow* platformAdoptWindow(const char* windowId, int width, int height) {
+    lastError = "Drawing in an existing window is not supported";
+    return NULL;
+}
+
 void platformDestroyWindow(PlatformWindow* window) {
     @autoreleasepool {
         if (window) {
@@ -179,6 +188,14 @@ void platformToggleFullscreen(PlatformWindow* window) {
     }
 }
 
+void platformSetScaleFilter(int smooth) {
+    // The view is drawn at the surface's size, never scaled
+}
+
+void platformSetAllOutputs(int all) {
+    // Only one window, on the main screen
+}
+
 void platformUpdateWindow(PlatformWindow* window) {
     @autoreleasepool {
         [window->view setNeedsDisplay:YES];
@@ -186,6 +203,26 @@ void platformUpdateWindow(PlatformWindow* window) {
     }
 }
 
+void platformRefreshWindow(PlatformWindow* window) {
+    // Single buffered: the window surface is the frame on screen
+    platformUpdateWindow(window);
+}
+
+void platformPresentWindow(PlatformWindow* window) {
+    // Single buffered: the frame is shown right away
+    platformUpdateWindow(window);
+}
+
+void platformSyncWindowSurface(PlatformWindow* window) {
+    // Nothing to do, the window surface is always the frame on screen
+}
+
+int platformIsWindowVisible(PlatformWindow* window) {
+    @autoreleasepool {
+        return ([window->nsWindow occlusionState] & NSWindowOcclusionStateVisible) != 0;
+    }
+}
+
 PlatformSurface* platformGetWindowSurface(PlatformWindow* window) {
     return window->surface;
 }
@@ -273,6 +310,33 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
     
     if (srcW <= 0 || srcH <= 0) return;
     
+    // Opaque source: whole rows can be copied, once clipped to both surfaces
+    if (!src->hasColorKey) {
+        int skipX = 0, skipY = 0;
+        if (srcX < 0) skipX = -srcX;
+        if (dstX + skipX < 0) skipX = -dstX;
+        if (srcY < 0) skipY = -srcY;
+        if (dstY + skipY < 0) skipY = -dstY;
+        
+        int w = srcW;
+        int h = srcH;
+        if (srcX + w > src->width) w = src->width - srcX;
+        if (dstX + w > dst->width) w = dst->width - dstX;
+        if (srcY + h > src->height) h = src->height - srcY;
+        if (dstY + h > dst->height) h = dst->height - dstY;
+        
+        w -= skipX;
+        h -= skipY;
+        if (w <= 0 || h <= 0) return;
+        
+        for (int y = skipY; y < skipY + h; y++) {
+            memcpy(dst->pixels + (dstY + y) * dst->pitch + (dstX + skipX) * dst->bytesPerPixel,
+                   src->pixels + (srcY + y) * src->pitch + (srcX + skipX) * src->bytesPerPixel,
+                   (size_t)w * 4);
+        }
+        return;
+    }
+    
     for (int y = 0; y < srcH; y++) {
         for (int x = 0; x < srcW; x++) {
             int sx = srcX + x;
@@ -287,12 +351,10 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
             uint8* dstPixel = dst->pixels + dy * dst->pitch + dx * dst->bytesPerPixel;
             
             // Check color key
-            if (src->hasColorKey) {
-                if (srcPixel[0] == src->colorKeyB &&
-                    srcPixel[1] == src->colorKeyG &&
-                    srcPixel[2] == src->colorKeyR) {
-                    continue;
-                }
+            if (srcPixel[0] == src->colorKeyB &&
+                srcPixel[1] == src->colorKeyG &&
+                srcPixel[2] == src->colorKeyR) {
+                continue;
             }
             
             memcpy(dstPixel, srcPixel, 4);
@@ -309,14 +371,34 @@ void platformFillRect(PlatformSurface* surface, PlatformRect* rect,
     int w = rect ? rect->w : surface->width;
     int h = rect ? rect->h : surface->height;
     
-    for (int py = y; py < y + h && py < surface->height; py++) {
-        for (int px = x; px < x + w && px < surface->width; px++) {
-            uint8* pixel = surface->pixels + py * surface->pitch + px * surface->bytesPerPixel;
-            pixel[0] = b;
-            pixel[1] = g;
-            pixel[2] = r;
-            pixel[3] = a;
-        }
+    // Clip to the surface clip rect
+    int x2 = x + w;
+    int y2 = y + h;
+    if (x < surface->clipRect.x) x = surface->clipRect.x;
+    if (y < surface->clipRect.y) y = surface->clipRect.y;
+    if (x2 > surface->clipRect.x + surface->clipRect.w) x2 = surface->clipRect.x + surface->clipRect.w;
+    if (y2 > surface->clipRect.y + surface->clipRect.h) y2 = surface->clipRect.y + surface->clipRect.h;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x2 > surface->width) x2 = surface->width;
+    if (y2 > surface->height) y2 = surface->height;
+    
+    if (x2 <= x || y2 <= y) return;
+    
+    // Fill the first row with 32-bit stores, then replicate it
+    uint8 bgra[4] = { b, g, r, a };
+    uint32 color;
+    memcpy(&color, bgra, 4);
+    
+    uint8* firstRow = surface->pixels + y * surface->pitch + x * surface->bytesPerPixel;
+    uint32* dst = (uint32*)firstRow;
+    for (int px = x; px < x2; px++) {
+        *dst++ = color;
+    }
+    
+    size_t rowBytes = (size_t)(x2 - x) * surface->bytesPerPixel;
+    for (int py = y + 1; py < y2; py++) {
+        memcpy(firstRow + (py - y) * surface->pitch, firstRow, rowBytes);
     }
 }
 
@@ -329,6 +411,15 @@ void platformSetColorKey(PlatformSurface* surface, uint8 r, uint8 g, uint8 b) {
     }
 }
 
+int platformGetColorKey(PlatformSurface* surface, uint8* r, uint8* g, uint8* b) {
+    if (!surface || !surface->hasColorKey) return 0;
+    
+    *r = surface->colorKeyR;
+    *g = surface->colorKeyG;
+    *b = surface->colorKeyB;
+    return 1;
+}
+
 void platformSetClipRect(PlatformSurface* surface, PlatformRect* rect) {
     if (surface) {
         if (rect) {
@@ -373,6 +464,10 @@ int platformGetSurfaceBytesPerPixel(PlatformSurface* surface) {
     return surface ? surface->bytesPerPixel : 0;
 }
 
+int platformGetPixelSize(void) {
+    return 4;   // BGRX only
+}
+
 // Events
 int platformPollEvent(PlatformEvent* event) {
     @autoreleasepool {
@@ -427,10 +522,33 @@ uint32 platformGetTicks(void) {
     return (uint32)((elapsed * timebaseInfo.numer) / (timebaseInfo.denom * 1000000));
 }
 
+uint64 platformGetMicros(void) {
+    uint64_t elapsed = mach_absolute_time() - startTime;
+    return (uint64)((elapsed * timebaseInfo.numer) / (timebaseInfo.denom * 1000));
+}
+
 void platformDelay(uint32 ms) {
     usleep(ms * 1000);
 }
 
+void platformWaitEvent(uint64 deadline) {
+    @autoreleasepool {
+        NSDate* until = [NSDate distantFuture];
+        
+        if (deadline != PLATFORM_NO_DEADLINE) {
+            uint64 now = platformGetMicros();
+            if (now >= deadline) return;
+            until = [NSDate dateWithTimeIntervalSinceNow:(deadline - now) / 1000000.0];
+        }
+        
+        // Left in the queue for platformPollEvent()
+        [NSApp nextEventMatchingMask:NSEventMaskAny
+                           untilDate:until
+                              inMode:NSDefaultRunLoopMode
+                             dequeue:NO];
+    }
+}
+
 // Audio
 static AudioQueueRef audioQueue = NULL;
 static PlatformAudioCallback audioCallback = NULL;
@@ -463,12 +581,15 @@ int platformOpenAudio(PlatformAudioSpec* spec) {
     format.mSampleRate = spec->freq;
     format.mFormatID = kAudioFormatLinearPCM;
     // 8-bit audio is unsigned, not signed (0-255, with 128 as silence)
+    int bytes = (spec->format == 16 ? 2 : 1);
     format.mFormatFlags = kLinearPCMFormatFlagIsPacked;
-    format.mBitsPerChannel = 8;
+    if (bytes == 2)
+        format.mFormatFlags |= kLinearPCMFormatFlagIsSignedInteger;
+    format.mBitsPerChannel = 8 * bytes;
     format.mChannelsPerFrame = spec->channels;
-    format.mBytesPerFrame = spec->channels;
+    format.mBytesPerFrame = spec->channels * bytes;
     format.mFramesPerPacket = 1;
-    format.mBytesPerPacket = spec->channels;
+    format.mBytesPerPacket = spec->channels * bytes;
     
     audioCallback = spec->callback;
     audioUserData = spec->userdata;
@@ -480,7 +601,7 @@ int platformOpenAudio(PlatformAudioSpec* spec) {
         return -1;
     }
     
-    int bufferSize = spec->samples * spec->channels;
+    int bufferSize = spec->samples * spec->channels * bytes;
     for (int i = 0; i < 3; i++) {
         AudioQueueAllocateBuffer(audioQueue, bufferSize, &audioBuffers[i]);
         audioBuffers[i]->mAudioDataByteSize = bufferSize;
@@ -508,6 +629,15 @@ void platformUnlockAudio(void) {
     // Not needed for AudioQueue
 }
 
+void platformWakeAudio(void) {
+    // The stream is never suspended
+}
+
+int platformGetAudioStats(PlatformAudioStats* stats) {
+    // Not measured
+    return -1;
+}
+
 int platformLoadWAV(const char* filename, PlatformAudioSpec* spec,
                     uint8** audio_buf, uint32* audio_len) {
     FILE* file = fopen(filename, "rb");
@@ -548,6 +678,32 @@ void platformFreeWAV(uint8* audio_buf) {
     free(audio_buf);
 }
 
+uint8* platformMapFile(const char* filename, uint32* size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        lastError = "Failed to open file";
+        return NULL;
+    }
+    
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    
+    if (data == MAP_FAILED) {
+        lastError = "Failed to map file";
+        return NULL;
+    }
+    
+    *size = (uint32)st.st_size;
+    return (uint8*)data;
+}
+
+void platformUnmapFile(uint8* data, uint32 size) {
+    munmap(data, size);
+}
+
 const char* platformGetError(void) {
     return lastError;
 }
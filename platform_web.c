@@ -36,6 +36,7 @@ struct PlatformWindow {
 };
 
 static PlatformWindow* mainWindow = NULL;
+static int scaleSmooth = 0;
 static PlatformEvent pendingEvents[32];
 static int pendingEventCount = 0;
 
@@ -99,6 +100,11 @@ PlatformWindow* platformCreateWindow(const char* title, int width, int height, i
     return window;
 }
 
+PlatformWindow* platformAdoptWindow(const char* windowId, int width, int height) {
+    lastError = "Drawing in an existing window is not supported";
+    return NULL;
+}
+
 void platformDestroyWindow(PlatformWindow* window) {
     if (window) {
         if (window->surface) {
@@ -120,12 +126,21 @@ void platformShowCursor(int show) {
     }
 }
 
+void platformSetScaleFilter(int smooth) {
+    scaleSmooth = smooth;
+}
+
+void platformSetAllOutputs(int all) {
+    // Only one window
+}
+
 void platformToggleFullscreen(PlatformWindow* window) {
     if (!window->isFullscreen) {
         EmscriptenFullscreenStrategy strategy = {
             .scaleMode = EMSCRIPTEN_FULLSCREEN_SCALE_DEFAULT,
             .canvasResolutionScaleMode = EMSCRIPTEN_FULLSCREEN_CANVAS_SCALE_NONE,
-            .filteringMode = EMSCRIPTEN_FULLSCREEN_FILTERING_DEFAULT
+            .filteringMode = (scaleSmooth ? EMSCRIPTEN_FULLSCREEN_FILTERING_BILINEAR
+                                          : EMSCRIPTEN_FULLSCREEN_FILTERING_NEAREST)
         };
         emscripten_request_fullscreen_strategy(window->canvasId, 1, &strategy);
     } else {
@@ -170,6 +185,24 @@ void platformUpdateWindow(PlatformWindow* window) {
     }, window->surface->width, window->surface->height, window->surface->pixels);
 }
 
+void platformRefreshWindow(PlatformWindow* window) {
+    // Single buffered: the window surface is the frame on screen
+    platformUpdateWindow(window);
+}
+
+void platformPresentWindow(PlatformWindow* window) {
+    // Single buffered: the frame is shown right away
+    platformUpdateWindow(window);
+}
+
+void platformSyncWindowSurface(PlatformWindow* window) {
+    // Nothing to do, the window surface is always the frame on screen
+}
+
+int platformIsWindowVisible(PlatformWindow* window) {
+    return !EM_ASM_INT({ return document.hidden ? 1 : 0; });
+}
+
 PlatformSurface* platformGetWindowSurface(PlatformWindow* window) {
     return window ? window->surface : NULL;
 }
@@ -251,6 +284,33 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
     
     if (srcW <= 0 || srcH <= 0) return;
     
+    // Opaque source: whole rows can be copied, once clipped to both surfaces
+    if (!src->hasColorKey) {
+        int skipX = 0, skipY = 0;
+        if (srcX < 0) skipX = -srcX;
+        if (dstX + skipX < 0) skipX = -dstX;
+        if (srcY < 0) skipY = -srcY;
+        if (dstY + skipY < 0) skipY = -dstY;
+        
+        int w = srcW;
+        int h = srcH;
+        if (srcX + w > src->width) w = src->width - srcX;
+        if (dstX + w > dst->width) w = dst->width - dstX;
+        if (srcY + h > src->height) h = src->height - srcY;
+        if (dstY + h > dst->height) h = dst->height - dstY;
+        
+        w -= skipX;
+        h -= skipY;
+        if (w <= 0 || h <= 0) return;
+        
+        for (int y = skipY; y < skipY + h; y++) {
+            memcpy(dst->pixels + (dstY + y) * dst->pitch + (dstX + skipX) * dst->bytesPerPixel,
+                   src->pixels + (srcY + y) * src->pitch + (srcX + skipX) * src->bytesPerPixel,
+                   (size_t)w * 4);
+        }
+        return;
+    }
+    
     for (int y = 0; y < srcH; y++) {
         for (int x = 0; x < srcW; x++) {
             int sx = srcX + x;
@@ -264,12 +324,10 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
             uint8* srcPixel = src->pixels + sy * src->pitch + sx * src->bytesPerPixel;
             uint8* dstPixel = dst->pixels + dy * dst->pitch + dx * dst->bytesPerPixel;
             
-            if (src->hasColorKey) {
-                if (srcPixel[0] == src->colorKeyB &&
-                    srcPixel[1] == src->colorKeyG &&
-                    srcPixel[2] == src->colorKeyR) {
-                    continue;
-                }
+            if (srcPixel[0] == src->colorKeyB &&
+                srcPixel[1] == src->colorKeyG &&
+                srcPixel[2] == src->colorKeyR) {
+                continue;
             }
             
             memcpy(dstPixel, srcPixel, 4);
@@ -286,14 +344,34 @@ void platformFillRect(PlatformSurface* surface, PlatformRect* rect,
     int w = rect ? rect->w : surface->width;
     int h = rect ? rect->h : surface->height;
     
-    for (int py = y; py < y + h && py < surface->height; py++) {
-        for (int px = x; px < x + w && px < surface->width; px++) {
-            uint8* pixel = surface->pixels + py * surface->pitch + px * surface->bytesPerPixel;
-            pixel[0] = b;
-            pixel[1] = g;
-            pixel[2] = r;
-            pixel[3] = a;
-        }
+    // Clip to the surface clip rect
+    int x2 = x + w;
+    int y2 = y + h;
+    if (x < surface->clipRect.x) x = surface->clipRect.x;
+    if (y < surface->clipRect.y) y = surface->clipRect.y;
+    if (x2 > surface->clipRect.x + surface->clipRect.w) x2 = surface->clipRect.x + surface->clipRect.w;
+    if (y2 > surface->clipRect.y + surface->clipRect.h) y2 = surface->clipRect.y + surface->clipRect.h;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x2 > surface->width) x2 = surface->width;
+    if (y2 > surface->height) y2 = surface->height;
+    
+    if (x2 <= x || y2 <= y) return;
+    
+    // Fill the first row with 32-bit stores, then replicate it
+    uint8 bgra[4] = { b, g, r, a };
+    uint32 color;
+    memcpy(&color, bgra, 4);
+    
+    uint8* firstRow = surface->pixels + y * surface->pitch + x * surface->bytesPerPixel;
+    uint32* dst = (uint32*)firstRow;
+    for (int px = x; px < x2; px++) {
+        *dst++ = color;
+    }
+    
+    size_t rowBytes = (size_t)(x2 - x) * surface->bytesPerPixel;
+    for (int py = y + 1; py < y2; py++) {
+        memcpy(firstRow + (py - y) * surface->pitch, firstRow, rowBytes);
     }
 }
 
@@ -306,6 +384,15 @@ void platformSetColorKey(PlatformSurface* surface, uint8 r, uint8 g, uint8 b) {
     }
 }
 
+int platformGetColorKey(PlatformSurface* surface, uint8* r, uint8* g, uint8* b) {
+    if (!surface || !surface->hasColorKey) return 0;
+    
+    *r = surface->colorKeyR;
+    *g = surface->colorKeyG;
+    *b = surface->colorKeyB;
+    return 1;
+}
+
 void platformSetClipRect(PlatformSurface* surface, PlatformRect* rect) {
     if (surface) {
         if (rect) {
@@ -349,6 +436,10 @@ int platformGetSurfaceBytesPerPixel(PlatformSurface* surface) {
     return surface ? surface->bytesPerPixel : 0;
 }
 
+int platformGetPixelSize(void) {
+    return 4;   // BGRX only
+}
+
 // Events
 int platformPollEvent(PlatformEvent* event) {
     if (pendingEventCount > 0) {
@@ -367,10 +458,28 @@ uint32 platformGetTicks(void) {
     return (uint32)(emscripten_get_now() - startTime);
 }
 
+uint64 platformGetMicros(void) {
+    return (uint64)((emscripten_get_now() - startTime) * 1000.0);
+}
+
 void platformDelay(uint32 ms) {
     emscripten_sleep(ms);
 }
 
+void platformWaitEvent(uint64 deadline) {
+    // Events come from the browser's callbacks, which run while we
+    // sleep: just check back every few milliseconds
+    uint32 delay = 5;
+    
+    if (deadline != PLATFORM_NO_DEADLINE) {
+        uint64 now = platformGetMicros();
+        if (now >= deadline) return;
+        if (deadline - now < delay * 1000) delay = (uint32)((deadline - now + 999) / 1000);
+    }
+    
+    emscripten_sleep(delay);
+}
+
 // Audio (Web Audio API)
 static PlatformAudioCallback audioCallback = NULL;
 static void* audioUserData = NULL;
@@ -434,6 +543,8 @@ void platformPauseAudio(int pause) {
 
 void platformLockAudio(void) {}
 void platformUnlockAudio(void) {}
+void platformWakeAudio(void) {}
+int platformGetAudioStats(PlatformAudioStats* stats) { return -1; }
 
 int platformLoadWAV(const char* filename, PlatformAudioSpec* spec,
                     uint8** audio_buf, uint32* audio_len) {
@@ -474,6 +585,35 @@ void platformFreeWAV(uint8* audio_buf) {
     free(audio_buf);
 }
 
+// The files are in memory already: a plain copy
+uint8* platformMapFile(const char* filename, uint32* size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        lastError = "Failed to open file";
+        return NULL;
+    }
+    
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    uint8* data = (fileSize > 0 ? (uint8*)malloc(fileSize) : NULL);
+    if (!data || fread(data, 1, fileSize, file) != (size_t)fileSize) {
+        free(data);
+        fclose(file);
+        lastError = "Failed to read file";
+        return NULL;
+    }
+    
+    fclose(file);
+    *size = (uint32)fileSize;
+    return data;
+}
+
+void platformUnmapFile(uint8* data, uint32 size) {
+    free(data);
+}
+
 const char* platformGetError(void) {
     return lastError;
 }
@@ -39,6 +39,7 @@ struct PlatformWindow {
 };
 
 static PlatformWindow* mainWindow = NULL;
+static int scaleSmooth = 0;
 static PlatformEvent pendingEvents[32];
 static int pendingEventCount = 0;
 
@@ -160,6 +161,11 @@ PlatformWindow* platformCreateWindow(const char* title, int width, int height, i
     return window;
 }
 
+PlatformWindow* platformAdoptWindow(const char* windowId, int width, int height) {
+    lastError = "Drawing in an existing window is not supported";
+    return NULL;
+}
+
 void platformDestroyWindow(PlatformWindow* window) {
     if (window) {
         if (window->surface) {
@@ -209,6 +215,14 @@ void platformToggleFullscreen(PlatformWindow* window) {
     window->isFullscreen = !window->isFullscreen;
 }
 
+void platformSetScaleFilter(int smooth) {
+    scaleSmooth = smooth;
+}
+
+void platformSetAllOutputs(int all) {
+    // Only one window, on the main monitor
+}
+
 void platformUpdateWindow(PlatformWindow* window) {
     if (!window || !window->surface) return;
     
@@ -259,6 +273,10 @@ void platformUpdateWindow(PlatformWindow* window) {
         }
     }
     
+    SetStretchBltMode(window->hdc, scaleSmooth ? HALFTONE : COLORONCOLOR);
+    if (scaleSmooth)
+        SetBrushOrgEx(window->hdc, 0, 0, NULL);
+    
     StretchDIBits(window->hdc,
                  destX, destY, destWidth, destHeight,
                  0, 0, window->surface->width, window->surface->height,
@@ -268,6 +286,24 @@ void platformUpdateWindow(PlatformWindow* window) {
                  SRCCOPY);
 }
 
+void platformRefreshWindow(PlatformWindow* window) {
+    // Single buffered: the window surface is the frame on screen
+    platformUpdateWindow(window);
+}
+
+void platformPresentWindow(PlatformWindow* window) {
+    // Single buffered: the frame is shown right away
+    platformUpdateWindow(window);
+}
+
+void platformSyncWindowSurface(PlatformWindow* window) {
+    // Nothing to do, the window surface is always the frame on screen
+}
+
+int platformIsWindowVisible(PlatformWindow* window) {
+    return window && !IsIconic(window->hwnd);
+}
+
 PlatformSurface* platformGetWindowSurface(PlatformWindow* window) {
     return window ? window->surface : NULL;
 }
@@ -349,6 +385,33 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
     
     if (srcW <= 0 || srcH <= 0) return;
     
+    // Opaque source: whole rows can be copied, once clipped to both surfaces
+    if (!src->hasColorKey) {
+        int skipX = 0, skipY = 0;
+        if (srcX < 0) skipX = -srcX;
+        if (dstX + skipX < 0) skipX = -dstX;
+        if (srcY < 0) skipY = -srcY;
+        if (dstY + skipY < 0) skipY = -dstY;
+        
+        int w = srcW;
+        int h = srcH;
+        if (srcX + w > src->width) w = src->width - srcX;
+        if (dstX + w > dst->width) w = dst->width - dstX;
+        if (srcY + h > src->height) h = src->height - srcY;
+        if (dstY + h > dst->height) h = dst->height - dstY;
+        
+        w -= skipX;
+        h -= skipY;
+        if (w <= 0 || h <= 0) return;
+        
+        for (int y = skipY; y < skipY + h; y++) {
+            memcpy(dst->pixels + (dstY + y) * dst->pitch + (dstX + skipX) * dst->bytesPerPixel,
+                   src->pixels + (srcY + y) * src->pitch + (srcX + skipX) * src->bytesPerPixel,
+                   (size_t)w * 4);
+        }
+        return;
+    }
+    
     for (int y = 0; y < srcH; y++) {
         for (int x = 0; x < srcW; x++) {
             int sx = srcX + x;
@@ -362,12 +425,10 @@ void platformBlitSurface(PlatformSurface* src, PlatformRect* srcRect,
             uint8* srcPixel = src->pixels + sy * src->pitch + sx * src->bytesPerPixel;
             uint8* dstPixel = dst->pixels + dy * dst->pitch + dx * dst->bytesPerPixel;
             
-            if (src->hasColorKey) {
-                if (srcPixel[0] == src->colorKeyB &&
-                    srcPixel[1] == src->colorKeyG &&
-                    srcPixel[2] == src->colorKeyR) {
-                    continue;
-                }
+            if (srcPixel[0] == src->colorKeyB &&
+                srcPixel[1] == src->colorKeyG &&
+                srcPixel[2] == src->colorKeyR) {
+                continue;
             }
             
             memcpy(dstPixel, srcPixel, 4);
@@ -384,14 +445,34 @@ void platformFillRect(PlatformSurface* surface, PlatformRect* rect,
     int w = rect ? rect->w : surface->width;
     int h = rect ? rect->h : surface->height;
     
-    for (int py = y; py < y + h && py < surface->height; py++) {
-        for (int px = x; px < x + w && px < surface->width; px++) {
-            uint8* pixel = surface->pixels + py * surface->pitch + px * surface->bytesPerPixel;
-            pixel[0] = b;
-            pixel[1] = g;
-            pixel[2] = r;
-            pixel[3] = a;
-        }
+    // Clip to the surface clip rect
+    int x2 = x + w;
+    int y2 = y + h;
+    if (x < surface->clipRect.x) x = surface->clipRect.x;
+    if (y < surface->clipRect.y) y = surface->clipRect.y;
+    if (x2 > surface->clipRect.x + surface->clipRect.w) x2 = surface->clipRect.x + surface->clipRect.w;
+    if (y2 > surface->clipRect.y + surface->clipRect.h) y2 = surface->clipRect.y + surface->clipRect.h;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x2 > surface->width) x2 = surface->width;
+    if (y2 > surface->height) y2 = surface->height;
+    
+    if (x2 <= x || y2 <= y) return;
+    
+    // Fill the first row with 32-bit stores, then replicate it
+    uint8 bgra[4] = { b, g, r, a };
+    uint32 color;
+    memcpy(&color, bgra, 4);
+    
+    uint8* firstRow = surface->pixels + y * surface->pitch + x * surface->bytesPerPixel;
+    uint32* dst = (uint32*)firstRow;
+    for (int px = x; px < x2; px++) {
+        *dst++ = color;
+    }
+    
+    size_t rowBytes = (size_t)(x2 - x) * surface->bytesPerPixel;
+    for (int py = y + 1; py < y2; py++) {
+        memcpy(firstRow + (py - y) * surface->pitch, firstRow, rowBytes);
     }
 }
 
@@ -404,6 +485,15 @@ void platformSetColorKey(PlatformSurface* surface, uint8 r, uint8 g, uint8 b) {
     }
 }
 
+int platformGetColorKey(PlatformSurface* surface, uint8* r, uint8* g, uint8* b) {
+    if (!surface || !surface->hasColorKey) return 0;
+    
+    *r = surface->colorKeyR;
+    *g = surface->colorKeyG;
+    *b = surface->colorKeyB;
+    return 1;
+}
+
 void platformSetClipRect(PlatformSurface* surface, PlatformRect* rect) {
     if (surface) {
         if (rect) {
@@ -447,6 +537,10 @@ int platformGetSurfaceBytesPerPixel(PlatformSurface* surface) {
     return surface ? surface->bytesPerPixel : 0;
 }
 
+int platformGetPixelSize(void) {
+    return 4;   // BGRX only
+}
+
 // Events
 int platformPollEvent(PlatformEvent* event) {
     MSG msg;
@@ -476,10 +570,31 @@ uint32 platformGetTicks(void) {
     return (uint32)((elapsed * 1000) / performanceFreq.QuadPart);
 }
 
+uint64 platformGetMicros(void) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    
+    uint64_t elapsed = now.QuadPart - startTime.QuadPart;
+    return (elapsed / performanceFreq.QuadPart) * 1000000
+           + ((elapsed % performanceFreq.QuadPart) * 1000000) / performanceFreq.QuadPart;
+}
+
 void platformDelay(uint32 ms) {
     Sleep(ms);
 }
 
+void platformWaitEvent(uint64 deadline) {
+    DWORD timeout = INFINITE;
+    
+    if (deadline != PLATFORM_NO_DEADLINE) {
+        uint64 now = platformGetMicros();
+        if (now >= deadline) return;
+        timeout = (DWORD)((deadline - now + 999) / 1000);
+    }
+    
+    MsgWaitForMultipleObjects(0, NULL, FALSE, timeout, QS_ALLINPUT);
+}
+
 // Audio (using waveOut API)
 static HWAVEOUT hWaveOut = NULL;
 static WAVEHDR waveHeaders[2];
@@ -487,6 +602,7 @@ static uint8* audioBuffers[2];
 static PlatformAudioCallback audioCallback = NULL;
 static void* audioUserData = NULL;
 static int audioBufferSize = 0;
+static int audioSilence = 128;          // 0 for 16-bit signed samples
 static HANDLE audioEvent = NULL;
 static HANDLE audioThread = NULL;
 static int audioThreadRunning = 0;
@@ -504,7 +620,7 @@ DWORD WINAPI AudioThreadProc(LPVOID lpParameter) {
                 if (audioCallback) {
                     audioCallback(audioUserData, audioBuffers[i], audioBufferSize);
                 } else {
-                    memset(audioBuffers[i], 128, audioBufferSize); // Silence (128 for 8-bit unsigned)
+                    memset(audioBuffers[i], audioSilence, audioBufferSize);
                 }
                 
                 // Prepare and queue the buffer
@@ -568,7 +684,7 @@ int platformOpenAudio(PlatformAudioSpec* spec) {
     wfx.wFormatTag = WAVE_FORMAT_PCM;
     wfx.nChannels = spec->channels;
     wfx.nSamplesPerSec = spec->freq;
-    wfx.wBitsPerSample = 8;
+    wfx.wBitsPerSample = (spec->format == 16 ? 16 : 8);
     wfx.nBlockAlign = wfx.nChannels * wfx.wBitsPerSample / 8;
     wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
     wfx.cbSize = 0;
@@ -582,7 +698,8 @@ int platformOpenAudio(PlatformAudioSpec* spec) {
     
     audioCallback = spec->callback;
     audioUserData = spec->userdata;
-    audioBufferSize = spec->samples * spec->channels;
+    audioBufferSize = spec->samples * wfx.nBlockAlign;
+    audioSilence = (spec->format == 16 ? 0 : 128);
     
     // Create audio event
     audioEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
@@ -590,7 +707,7 @@ int platformOpenAudio(PlatformAudioSpec* spec) {
     // Allocate and prepare buffers
     for (int i = 0; i < 2; i++) {
         audioBuffers[i] = (uint8*)malloc(audioBufferSize);
-        memset(audioBuffers[i], 128, audioBufferSize); // Silence
+        memset(audioBuffers[i], audioSilence, audioBufferSize);
         
         memset(&waveHeaders[i], 0, sizeof(WAVEHDR));
         waveHeaders[i].lpData = (LPSTR)audioBuffers[i];
@@ -626,6 +743,15 @@ void platformUnlockAudio(void) {
     // Not needed for waveOut
 }
 
+void platformWakeAudio(void) {
+    // The stream is never suspended
+}
+
+int platformGetAudioStats(PlatformAudioStats* stats) {
+    // Not measured
+    return -1;
+}
+
 int platformLoadWAV(const char* filename, PlatformAudioSpec* spec,
                     uint8** audio_buf, uint32* audio_len) {
     FILE* file = fopen(filename, "rb");
@@ -665,6 +791,39 @@ void platformFreeWAV(uint8* audio_buf) {
     free(audio_buf);
 }
 
+uint8* platformMapFile(const char* filename, uint32* size) {
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        lastError = "Failed to open file";
+        return NULL;
+    }
+    
+    DWORD fileSize = GetFileSize(file, NULL);
+    HANDLE mapping = NULL;
+    void* data = NULL;
+    
+    if (fileSize != INVALID_FILE_SIZE && fileSize > 0)
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);   // The view keeps it alive
+    }
+    CloseHandle(file);
+    
+    if (!data) {
+        lastError = "Failed to map file";
+        return NULL;
+    }
+    
+    *size = fileSize;
+    return (uint8*)data;
+}
+
+void platformUnmapFile(uint8* data, uint32 size) {
+    UnmapViewOfFile(data);
+}
+
 const char* platformGetError(void) {
     return lastError;
 }
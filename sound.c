@@ -22,45 +22,575 @@
  */
 
 #include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mytypes.h"
 #include "utils.h"
 #include "sound.h"
+#include "sound_data.h"
+
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+#define SOUND_USE_THREADS
+#include <pthread.h>
+#endif
 
 
 #define NUM_OF_SOUNDS  25
+#define NUM_OF_VOICES  4
+#define RING_SIZE      64      // commands, a power of two
 
+// What the device is asked for. It may well prefer another rate or
+// number of channels, which the sounds are then converted to.
+#define DEVICE_FREQ      48000
+#define DEVICE_CHANNELS  2
 
-struct TSound {
-    uint32  length;
+
+// The engine never touches what the audio thread plays: it posts
+// commands in a ring, which the audio thread reads before mixing each
+// buffer. Each side only ever writes its own index of the ring.
+
+enum { CMD_PLAY, CMD_STOP, CMD_VOLUME };
+
+struct TSoundCommand {
+    int type;
+    int arg;
+};
+
+// As loaded: in place in SCRANTIC.SCR, or read from a WAV file
+struct TSoundSource {
+    uint32  length;     // bytes
     uint8   *data;
+    PlatformAudioSpec spec;
+};
+
+// As played: 16-bit, at the device's rate and number of channels
+struct TSound {
+    uint32  length;     // samples
+    sint16  *data;
+};
+
+struct TVoice {
+    sint16  *ptr;
+    uint32  remaining;
 };
 
 
 int soundDisabled = 0;
 
+// What the device buffers, hence how late sounds are heard
+int soundPeriodSize = 256;      // frames
+int soundNumPeriods = 3;
+
+// How the sounds are converted to the device's rate, once at start-up
+int soundResampleQuality = RESAMPLE_LINEAR;
+
+// Where the mix goes. Other than the device, sinks mix as the clock
+// goes, or in virtual time: as the engine's ticks go, however fast
+int  soundSink = SINK_DEVICE;
+char *soundSinkFilename = NULL;
+int  soundVirtualTime = 0;
+
 
 static struct TSound sounds[NUM_OF_SOUNDS];
-static struct TSound *currentSound;
+static struct TSoundSource sources[NUM_OF_SOUNDS];
+
+// SCRANTIC.SCR, mapped: sources[] then point into it
+static uint8  *soundBank = NULL;
+static uint32 soundBankSize = 0;
+
+static struct TSoundCommand ring[RING_SIZE];
+static uint32 ringHead = 0;     // written by the engine
+static uint32 ringTail = 0;     // written by the audio thread
+
+// Only touched by the audio thread
+static struct TVoice voices[NUM_OF_VOICES];
+static int volume = 256;
+
+// The null and WAV file sinks
+static PlatformAudioSpec sinkSpec;
+static sint16    *sinkBuffer = NULL;
+static FILE      *sinkFile = NULL;
+static uint64    sinkFrames = 0;        // mixed so far
+static uint64    sinkFileFrames = 0;    // written to the WAV file
+static uint64    sinkMaxFileFrames = 0;
+static uint64    sinkTime = 0;          // us, in virtual time
+static uint64    sinkMixTime = 0;       // us spent mixing
+#ifdef SOUND_USE_THREADS
+static pthread_t sinkThread;
+static int       sinkThreadRunning = 0;
+#endif
+
+
+static void soundPostCommand(int type, int arg)
+{
+    uint32 head = ringHead;
+
+    if (head - __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+        debugMsg("Sound command queue full, command dropped");
+        return;
+    }
+
+    ring[head % RING_SIZE].type = type;
+    ring[head % RING_SIZE].arg  = arg;
+
+    __atomic_store_n(&ringHead, head + 1, __ATOMIC_RELEASE);
+}
+
+
+static void soundStartVoice(struct TSound *sound)
+{
+    struct TVoice *voice = &voices[0];
+
+    // A free voice, or else the one closest to its end
+    for (int i=0; i < NUM_OF_VOICES; i++) {
+        if (voices[i].remaining < voice->remaining)
+            voice = &voices[i];
+    }
+
+    voice->ptr       = sound->data;
+    voice->remaining = sound->length;
+}
+
+
+static void soundReadCommands(void)
+{
+    uint32 tail = ringTail;
+    uint32 head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+
+    for (; tail != head; tail++) {
+
+        struct TSoundCommand *cmd = &ring[tail % RING_SIZE];
+
+        switch (cmd->type) {
+
+            case CMD_PLAY:
+                soundStartVoice(&sounds[cmd->arg]);
+                break;
+
+            case CMD_STOP:
+                for (int i=0; i < NUM_OF_VOICES; i++)
+                    voices[i].remaining = 0;
+                break;
+
+            case CMD_VOLUME:
+                volume = cmd->arg;
+                break;
+        }
+    }
+
+    __atomic_store_n(&ringTail, tail, __ATOMIC_RELEASE);
+}
+
+
+// Adds a voice to the mix, saturating
+static void soundMixVoice(sint16 *dst, sint16 *src, int len)
+{
+    int i = 0;
+
+    if (volume == 256) {
+#ifdef __SSE2__
+        for (; i + 8 <= len; i += 8) {
+            __m128i a = _mm_loadu_si128((__m128i *) (dst + i));
+            __m128i b = _mm_loadu_si128((__m128i *) (src + i));
+            _mm_storeu_si128((__m128i *) (dst + i), _mm_adds_epi16(a, b));
+        }
+#endif
+        for (; i < len; i++) {
+            int sample = dst[i] + src[i];
+            dst[i] = (sample < -32768 ? -32768 : sample > 32767 ? 32767 : sample);
+        }
+    }
+    else {
+        for (; i < len; i++) {
+            int sample = dst[i] + ((src[i] * volume) >> 8);
+            dst[i] = (sample < -32768 ? -32768 : sample > 32767 ? 32767 : sample);
+        }
+    }
+}
+
+
+static int soundCallback(void *userdata, uint8 *stream, int rqdLen)
+{
+    sint16 *samples = (sint16 *) stream;
+    uint32 numSamples = rqdLen / sizeof(sint16);
+    int isPlaying = 0;
+
+    soundReadCommands();
+
+    memset(stream, 0, rqdLen);
 
-static uint8  *currentPtr;
-static uint32 currentRemaining;
+    for (int i=0; i < NUM_OF_VOICES; i++) {
 
+        struct TVoice *voice = &voices[i];
+        uint32 len = (voice->remaining < numSamples ? voice->remaining : numSamples);
 
-static void soundCallback(void *userdata, uint8 *stream, int rqdLen)
+        if (len) {
+            soundMixVoice(samples, voice->ptr, len);
+            voice->ptr += len;
+            voice->remaining -= len;
+            isPlaying = 1;
+        }
+    }
+
+    return isPlaying;
+}
+
+
+// Walk the chunks of the WAV image at 'data' and point 'source' at its
+// samples, in place. 'size' is what's left of the file from 'data'.
+
+static int soundParseWav(uint8 *data, uint32 size, struct TSoundSource *source)
 {
-    if (currentRemaining > rqdLen) {
-        memcpy(stream, currentPtr, rqdLen);
-        currentPtr += rqdLen;
-        currentRemaining -= rqdLen;
+    PlatformAudioSpec *spec = &source->spec;
+
+    if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4))
+        return 0;
+
+    int hasFormat = 0;
+    uint32 offset = 12;
+
+    while (offset + 8 <= size) {
+
+        uint8 *chunk = data + offset;
+
+        offset += 4;
+        uint32 chunkSize = peekUint32(data, &offset);
+        uint32 fields = offset;
+
+        if (!memcmp(chunk, "fmt ", 4) && chunkSize >= 16 && offset + 16 <= size) {
+            fields += 2;
+            spec->channels = peekUint16(data, &fields);
+            spec->freq     = peekUint32(data, &fields);
+            fields += 6;
+            spec->format   = peekUint16(data, &fields);
+            hasFormat = 1;
+        }
+        else if (!memcmp(chunk, "data", 4)) {
+            if (!hasFormat)
+                return 0;
+            source->data   = data + offset;
+            source->length = chunkSize;
+            if (source->length > size - offset)
+                source->length = size - offset;
+            return 1;
+        }
+
+        if (chunkSize > size - offset)
+            break;
+
+        offset += chunkSize + (chunkSize & 1);
+    }
+
+    return 0;
+}
+
+
+// Map the resource file the sounds come with, rather than reading
+// each of them from its own WAV file. Returns the number of sounds found.
+
+static int soundLoadBank(char *filename)
+{
+    soundBank = platformMapFile(filename, &soundBankSize);
+
+    if (soundBank == NULL) {
+        debugMsg("platformMapFile() warning: %s", platformGetError());
+        return 0;
+    }
+
+    int numSounds = 0;
+
+    for (int i=1; i < NUM_OF_SOUNDS && i <= NUM_OF_SCR_SOUNDS; i++) {
+
+        uint32 offset = soundOffsets[i-1];
+
+        if (offset < soundBankSize
+                && soundParseWav(soundBank + offset, soundBankSize - offset, &sources[i]))
+            numSounds++;
+        else
+            debugMsg("Sound #%d not found in %s", i, filename);
+    }
+
+    if (numSounds == 0) {
+        platformUnmapFile(soundBank, soundBankSize);
+        soundBank = NULL;
+    }
+
+    return numSounds;
+}
+
+
+static void soundFreeSources(void)
+{
+    if (soundBank != NULL) {
+        platformUnmapFile(soundBank, soundBankSize);
+        soundBank = NULL;
     }
     else {
-        memcpy(stream, currentPtr, currentRemaining);
-        memset(stream + currentRemaining, 127, rqdLen - currentRemaining);  // 127 == silence
-        currentRemaining = 0;
-        //SDL_PauseAudio(1);
+        for (int i=0; i < NUM_OF_SOUNDS; i++)
+            if (sources[i].data != NULL)
+                platformFreeWAV(sources[i].data);
+    }
+
+    memset(sources, 0, sizeof(sources));
+}
+
+
+// Frame 'n' of a source, its channels mixed down, on 16 bits. Frames
+// out of the sound are silent, for the interpolation to fade in and out.
+
+static int soundSourceSample(struct TSoundSource *source, int n)
+{
+    int bytes    = (source->spec.format == 16 ? 2 : 1);
+    int channels = (source->spec.channels ? source->spec.channels : 1);
+
+    if (n < 0 || (uint32) n >= source->length / (bytes * channels))
+        return 0;
+
+    uint8 *ptr = source->data + n * bytes * channels;
+    int sum = 0;
+
+    for (int i=0; i < channels; i++, ptr += bytes)
+        sum += (bytes == 2 ? (sint16) (ptr[0] | (ptr[1] << 8)) : (ptr[0] - 128) << 8);
+
+    return sum / channels;
+}
+
+
+// Convert a source to what the device plays, so that the audio thread
+// only ever has to add samples together.
+
+static void soundResample(struct TSoundSource *source, struct TSound *sound,
+                          PlatformAudioSpec *spec)
+{
+    int bytes    = (source->spec.format == 16 ? 2 : 1);
+    int channels = (source->spec.channels ? source->spec.channels : 1);
+    uint32 numFrames = source->length / (bytes * channels);
+    uint32 srcFreq   = source->spec.freq;
+
+    if (numFrames == 0 || srcFreq == 0)
+        return;
+
+    // Position in the source in 32.32 fixed point, one step per frame out
+    uint64 step = ((uint64) srcFreq << 32) / spec->freq;
+    uint64 pos  = 0;
+    uint32 outFrames = ((uint64) numFrames * spec->freq + srcFreq - 1) / srcFreq;
+
+    sound->data   = safe_malloc(outFrames * spec->channels * sizeof(sint16));
+    sound->length = outFrames * spec->channels;
+
+    for (uint32 i=0; i < outFrames; i++, pos += step) {
+
+        int n    = pos >> 32;
+        int frac = (pos >> 17) & 0x7fff;     // 15 bits
+        int sample;
+
+        if (soundResampleQuality == RESAMPLE_NEAREST) {
+            sample = soundSourceSample(source, n + (frac >> 14));
+        }
+        else if (soundResampleQuality == RESAMPLE_LINEAR) {
+            int s0 = soundSourceSample(source, n);
+            int s1 = soundSourceSample(source, n + 1);
+            sample = s0 + (((s1 - s0) * frac) >> 15);
+        }
+        else {
+            // Catmull-Rom, through the two frames around and the next ones
+            float t  = frac / 32768.0f;
+            int   p0 = soundSourceSample(source, n - 1);
+            int   p1 = soundSourceSample(source, n);
+            int   p2 = soundSourceSample(source, n + 1);
+            int   p3 = soundSourceSample(source, n + 2);
+            float v  = p1 + 0.5f * t * (p2 - p0 + t * (2*p0 - 5*p1 + 4*p2 - p3
+                                        + t * (3 * (p1 - p2) + p3 - p0)));
+            sample = (v < -32768 ? -32768 : v > 32767 ? 32767 : (int) v);
+        }
+
+        for (int j=0; j < spec->channels; j++)
+            sound->data[i * spec->channels + j] = sample;
+    }
+}
+
+
+static void soundPutUint16(uint8 *ptr, uint16 value)
+{
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+}
+
+
+static void soundPutUint32(uint8 *ptr, uint32 value)
+{
+    soundPutUint16(ptr, value);
+    soundPutUint16(ptr + 2, value >> 16);
+}
+
+
+// A canonical 44-byte header: written first with no data, then again
+// once the data size is known
+static void soundWriteWavHeader(FILE *f, PlatformAudioSpec *spec, uint32 dataSize)
+{
+    uint8 header[44];
+    int frameSize = spec->channels * sizeof(sint16);
+
+    memcpy(header, "RIFF", 4);
+    soundPutUint32(header + 4, 36 + dataSize);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    soundPutUint32(header + 16, 16);
+    soundPutUint16(header + 20, 1);             // PCM
+    soundPutUint16(header + 22, spec->channels);
+    soundPutUint32(header + 24, spec->freq);
+    soundPutUint32(header + 28, spec->freq * frameSize);
+    soundPutUint16(header + 32, frameSize);
+    soundPutUint16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    soundPutUint32(header + 40, dataSize);
+
+    fseek(f, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), f);
+    fseek(f, 0, SEEK_END);
+}
+
+
+// Little-endian samples, up to the most a WAV file can hold: its RIFF
+// chunk size, 36 + the data size, is 32-bit
+static void soundSinkWrite(uint32 numFrames)
+{
+    uint64 room = sinkMaxFileFrames - sinkFileFrames;
+
+    if (room == 0)
+        return;
+
+    if (numFrames >= room) {
+        numFrames = room;
+        debugMsg("Warning: %s is full, the rest of the sound is dropped", soundSinkFilename);
+    }
+
+    uint32 numSamples = numFrames * sinkSpec.channels;
+
+    for (uint32 i=0; i < numSamples; i++)
+        soundPutUint16((uint8 *) &sinkBuffer[i], sinkBuffer[i]);
+
+    fwrite(sinkBuffer, sizeof(sint16), numSamples, sinkFile);
+    sinkFileFrames += numFrames;
+}
+
+
+// Mix that many frames, period by period, as the device would
+static void soundSinkMix(uint64 numFrames)
+{
+    int isWritten = (sinkFile != NULL && numFrames);
+
+    while (numFrames) {
+
+        uint32 len = (numFrames < sinkSpec.samples ? numFrames : sinkSpec.samples);
+        uint64 startTime = platformGetMicros();
+
+        soundCallback(NULL, (uint8 *) sinkBuffer, len * sinkSpec.channels * sizeof(sint16));
+        sinkMixTime += platformGetMicros() - startTime;
+
+        if (sinkFile != NULL)
+            soundSinkWrite(len);
+
+        sinkFrames += len;
+        numFrames  -= len;
+    }
+
+    // The sizes are kept up to date, so that the file is a valid one
+    // however the process ends. The header's seeks flush the samples.
+    if (isWritten)
+        soundWriteWavHeader(sinkFile, &sinkSpec,
+                            sinkFileFrames * sinkSpec.channels * sizeof(sint16));
+}
+
+
+#ifdef SOUND_USE_THREADS
+
+// In real time, a period is mixed whenever the device would want one
+static void *soundSinkThread(void *arg)
+{
+    uint64 startTime = platformGetMicros();
+
+    while (__atomic_load_n(&sinkThreadRunning, __ATOMIC_ACQUIRE)) {
+
+        soundSinkMix(sinkSpec.samples);
+
+        uint64 deadline = startTime + sinkFrames * 1000000 / sinkSpec.freq;
+        uint64 now = platformGetMicros();
+
+        if (now < deadline)
+            platformDelay((deadline - now) / 1000);
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+static int soundOpenSink(PlatformAudioSpec *spec)
+{
+    sinkSpec   = *spec;
+    sinkFrames = 0;
+    sinkFileFrames = 0;
+    sinkMaxFileFrames = (0xffffffff - 36) / (spec->channels * sizeof(sint16));
+    sinkTime   = 0;
+    sinkMixTime = 0;
+
+    if (soundSink == SINK_WAV) {
+        sinkFile = fopen(soundSinkFilename, "wb");
+        if (sinkFile == NULL) {
+            debugMsg("Can't create %s", soundSinkFilename);
+            return -1;
+        }
+        soundWriteWavHeader(sinkFile, spec, 0);
+    }
+
+    sinkBuffer = safe_malloc(spec->samples * spec->channels * sizeof(sint16));
+
+    if (!soundVirtualTime) {
+#ifdef SOUND_USE_THREADS
+        sinkThreadRunning = 1;
+        if (pthread_create(&sinkThread, NULL, soundSinkThread, NULL) != 0) {
+            debugMsg("Can't start the audio sink thread");
+            sinkThreadRunning = 0;
+            return -1;
+        }
+#else
+        // No thread to mix as the clock goes: the sink follows the ticks
+        debugMsg("Warning: no real time audio sink here, using virtual time");
+        soundVirtualTime = 1;
+#endif
     }
+
+    return 0;
+}
+
+
+static void soundCloseSink(void)
+{
+#ifdef SOUND_USE_THREADS
+    if (sinkThreadRunning) {
+        __atomic_store_n(&sinkThreadRunning, 0, __ATOMIC_RELEASE);
+        pthread_join(sinkThread, NULL);
+    }
+#endif
+
+    if (sinkFile != NULL) {
+        soundWriteWavHeader(sinkFile, &sinkSpec,
+                            sinkFileFrames * sinkSpec.channels * sizeof(sint16));
+        fclose(sinkFile);
+        sinkFile = NULL;
+    }
+
+    free(sinkBuffer);
+    sinkBuffer = NULL;
+
+    debugMsg("Audio: %u frames mixed in %u ms",
+             (uint32) sinkFrames, (uint32) (sinkMixTime / 1000));
 }
 
 
@@ -69,39 +599,67 @@ void soundInit(void)
     if (soundDisabled)
         return;
 
-    if (platformInitAudio() < 0) {
+    if (soundSink == SINK_DEVICE && platformInitAudio() < 0) {
         debugMsg("Platform init audio error: %s", platformGetError());
         soundDisabled = 1;
         return;
     }
 
-    PlatformAudioSpec audioSpec;
+    if (!soundLoadBank("data/SCRANTIC.SCR")) {
+
+        debugMsg("No sound in SCRANTIC.SCR, loading the WAV files");
 
-    for (int i=1; i < NUM_OF_SOUNDS; i++) {
+        for (int i=1; i < NUM_OF_SOUNDS; i++) {
 
-        char filename[20];
+            char filename[20];
 
-        sprintf(filename, "data/sound%d.wav", i);
+            sprintf(filename, "data/sound%d.wav", i);
 
-        if (platformLoadWAV(filename, &audioSpec, &sounds[i].data, &sounds[i].length) != 0) {
-            sounds[i].data   = NULL;
-            sounds[i].length = 0;
-            debugMsg("platformLoadWAV() warning: %s", platformGetError());
+            if (platformLoadWAV(filename, &sources[i].spec, &sources[i].data, &sources[i].length) != 0) {
+                sources[i].data   = NULL;
+                sources[i].length = 0;
+                debugMsg("platformLoadWAV() warning: %s", platformGetError());
+            }
         }
     }
 
+    PlatformAudioSpec audioSpec;
+
+    audioSpec.freq     = DEVICE_FREQ;
+    audioSpec.format   = 16;
+    audioSpec.channels = DEVICE_CHANNELS;
     audioSpec.callback = soundCallback;
     audioSpec.userdata = NULL;
-    audioSpec.samples  = 1024;
-
-    if (platformOpenAudio(&audioSpec) < 0) {
+    audioSpec.samples  = soundPeriodSize;
+    audioSpec.periods  = soundNumPeriods;
+
+    if (soundSink != SINK_DEVICE) {
+        if (soundOpenSink(&audioSpec) < 0) {
+            soundCloseSink();
+            soundFreeSources();
+            soundDisabled = 1;
+            return;
+        }
+    }
+    else if (platformOpenAudio(&audioSpec) < 0) {
         debugMsg("platformOpenAudio() error: %s", platformGetError());
+        soundFreeSources();
         soundDisabled = 1;
         return;
     }
 
-    currentRemaining = 0;
-    platformPauseAudio(0);
+    // No sound is played before soundPlay(), so the audio thread
+    // doesn't look at sounds[] while they are being converted
+    for (int i=1; i < NUM_OF_SOUNDS; i++)
+        soundResample(&sources[i], &sounds[i], &audioSpec);
+
+    soundFreeSources();
+
+    debugMsg("Audio: sounds converted to %d Hz, %d channel(s)",
+             audioSpec.freq, audioSpec.channels);
+
+    if (soundSink == SINK_DEVICE)
+        platformPauseAudio(0);
 }
 
 
@@ -110,11 +668,29 @@ void soundEnd()
     if (soundDisabled)
         return;
 
-    platformCloseAudio();
+    if (soundSink != SINK_DEVICE) {
+        soundCloseSink();
+    }
+    else {
+        platformCloseAudio();
 
-    for (int i=0; i < NUM_OF_SOUNDS; i++)
-        if (sounds[i].data != NULL)
-            platformFreeWAV(sounds[i].data);
+        PlatformAudioStats stats;
+
+        if (platformGetAudioStats(&stats) == 0)
+            debugMsg("Audio: periods of %u frames, buffer of %u frames (%u us), "
+                     "latency %u us (max %u us), %u underruns, %u suspends",
+                     stats.periodSize, stats.bufferSize, stats.bufferLatency,
+                     stats.latency, stats.maxLatency, stats.numXruns, stats.numSuspends);
+    }
+
+    // The audio thread is gone: no voice may be left on a freed sound
+    memset(voices, 0, sizeof(voices));
+
+    for (int i=0; i < NUM_OF_SOUNDS; i++) {
+        free(sounds[i].data);
+        sounds[i].data   = NULL;
+        sounds[i].length = 0;
+    }
 }
 
 
@@ -129,17 +705,41 @@ void soundPlay(int nb)
     }
 
     if (sounds[nb].length) {
+        soundPostCommand(CMD_PLAY, nb);
+        platformWakeAudio();
+    }
+    else
+        debugMsg("Non-existent sound sample #%d", nb);
+}
 
-        platformLockAudio();
 
-        currentSound     = &sounds[nb];
-        currentPtr       = currentSound->data;
-        currentRemaining = currentSound->length;
+void soundStop(void)
+{
+    if (soundDisabled)
+        return;
 
-        platformUnlockAudio();
-    }
-    else {
-        debugMsg("Non-existent sound sample #%d", nb);
-    }
+    soundPostCommand(CMD_STOP, 0);
+}
+
+
+// From 0 (mute) to 256 (samples as they are)
+void soundSetVolume(int vol)
+{
+    if (soundDisabled)
+        return;
+
+    soundPostCommand(CMD_VOLUME, (vol < 0 ? 0 : vol > 256 ? 256 : vol));
 }
 
+
+
+// In virtual time, what the sinks mix is what the engine's clock says,
+// to the sample: 'us' is how long the tick just done stands for
+void soundAdvance(uint32 us)
+{
+    if (soundDisabled || soundSink == SINK_DEVICE || !soundVirtualTime)
+        return;
+
+    sinkTime += us;
+    soundSinkMix(sinkTime * sinkSpec.freq / 1000000 - sinkFrames);
+}
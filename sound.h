@@ -21,9 +21,21 @@
  *
  */
 
+enum { RESAMPLE_NEAREST, RESAMPLE_LINEAR, RESAMPLE_CUBIC };
+enum { SINK_DEVICE, SINK_NULL, SINK_WAV };
+
 extern int soundDisabled;
+extern int soundPeriodSize;
+extern int soundNumPeriods;
+extern int soundResampleQuality;
+extern int  soundSink;
+extern char *soundSinkFilename;
+extern int  soundVirtualTime;
 
 void soundInit(void);
 void soundEnd(void);
 void soundPlay(int nb);
+void soundStop(void);
+void soundSetVolume(int vol);
+void soundAdvance(uint32 us);
 
@@ -0,0 +1,40 @@
+/*
+ *  This file is part of 'Johnny Reborn'
+ *
+ *  An open-source engine for the classic
+ *  'Johnny Castaway' screensaver by Sierra.
+ *
+ *  Copyright (C) 2019 Jeremie GUILLAUME
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define NUM_OF_SCR_SOUNDS  24
+
+// soundOffsets[]: where sounds #1 to #24 are found in SCRANTIC.SCR,
+// each one a complete WAV image. Used by the engine, which plays them
+// in place, and by tools/extract_sound.c
+
+static const int soundOffsets[NUM_OF_SCR_SOUNDS] = {
+    0x1DC00, 0x20800, 0x20E00,
+    0x22C00, 0x24000, 0x24C00,
+    0x28A00, 0x2C600, 0x2D000,
+    0x2DE00, 0x34400, 0x32E00,
+    0x39C00, 0x43400, 0x37200,
+    0x37E00, 0x45A00, 0x3AE00,
+    0x3E600, 0x3F400, 0x41200,
+    0x42600, 0x42C00, 0x43400
+};
+
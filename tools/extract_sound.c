@@ -27,17 +27,7 @@
 
 #include "../mytypes.h"
 #include "../utils.h"
-
-int offsets[] = {
-    0x1DC00, 0x20800, 0x20E00,
-    0x22C00, 0x24000, 0x24C00,
-    0x28A00, 0x2C600, 0x2D000,
-    0x2DE00, 0x34400, 0x32E00,
-    0x39C00, 0x43400, 0x37200,
-    0x37E00, 0x45A00, 0x3AE00,
-    0x3E600, 0x3F400, 0x41200,
-    0x42600, 0x42C00, 0x43400
-};
+#include "../sound_data.h"
 
 // gcc extract_sound.c utils.c -o extract_sound
 int main()
@@ -45,24 +35,24 @@ int main()
     FILE *f;
     f = fopen("../data/SCRANTIC.SCR","r");
 
-    for (int j=0; j < 24; j++) {
+    for (int j=0; j < NUM_OF_SCR_SOUNDS; j++) {
         FILE *fw;
         uint8 *data;
         int size = 0;
         char *buffer = NULL;
         char filename[20];
 
-        printf("offset %d\n", offsets[j]);
-        if (offsets[j] == -1) {
+        printf("offset %d\n", soundOffsets[j]);
+        if (soundOffsets[j] == -1) {
             continue;
         }
         
-        fseek(f, offsets[j], SEEK_SET);
+        fseek(f, soundOffsets[j], SEEK_SET);
         size = readUint16(f) + 8;
         printf("j %d, size: %d\n", j, size);
 
         buffer = (char*)malloc(size * sizeof(char));
-        fseek(f, offsets[j], SEEK_SET);
+        fseek(f, soundOffsets[j], SEEK_SET);
         fread(buffer, sizeof(char), size, f);
 
         sprintf(filename, "../data/sound%d.wav", j + 1);
@@ -166,6 +166,19 @@ uint16 peekUint16(uint8 *data, uint32 *offset)
 }
 
 
+uint32 peekUint32(uint8 *data, uint32 *offset)
+{
+    uint32 result;
+
+    result  = data[(*offset)++];
+    result |= data[(*offset)++] << 8;
+    result |= data[(*offset)++] << 16;
+    result |= (uint32) data[(*offset)++] << 24;
+
+    return result;
+}
+
+
 void peekUint16Block(uint8 *data, uint32 *offset, uint16 *dest, int len)
 {
     for (int i=0; i < len ; i++)
@@ -38,6 +38,7 @@ char   *getString(FILE *f, int maxlen);
 uint8  *readUint8Block(FILE *f, int len);
 uint16 *readUint16Block(FILE *f, int len);
 uint16 peekUint16(uint8 *data, uint32 *offset);
+uint32 peekUint32(uint8 *data, uint32 *offset);
 void   peekUint16Block(uint8 *data, uint32 *offset, uint16 *dest, int len);
 void   hexdump(uint8 *data, uint32 len);
 int    getDayOfYear(void);